@@ -0,0 +1,140 @@
+#include "net/IcmpReplyView.h"
+#include "net/ProbeTemplate.h"
+#include "net/FamilyTraits.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+constexpr size_t DEF_ITERATIONS = 10000000;
+
+// Payload of our probes: the cookie followed by the message
+constexpr size_t PAYLOAD_LEN = 4 + 20;
+
+constexpr u_int8_t ICMP4_TIME_EXCEEDED = 11;
+constexpr u_int8_t ICMP6_TIME_EXCEEDED_TYPE = 3;
+
+/* Keeps the compiler from dropping the measured work */
+static volatile u_int32_t sink;
+
+/* Function writes an echo header with type, ID and SEQ at buf */
+static void put_echo(char *buf, u_int8_t type, u_int16_t id, u_int16_t seq) {
+    buf[0] = type;
+    u_int16_t id_n = htons(id), seq_n = htons(seq);
+    memcpy(buf + 4, &id_n, sizeof (id_n));
+    memcpy(buf + 6, &seq_n, sizeof (seq_n));
+}
+
+/* Function writes an IPv4 header without options at buf */
+static void put_ip4(char *buf) {
+    buf[0] = 0x45;
+    buf[8] = 64;
+    buf[9] = IPPROTO_ICMP;
+}
+
+/* Function writes an IPv6 header at buf */
+static void put_ip6(char *buf) {
+    buf[0] = 0x60;
+    buf[6] = IPPROTO_ICMPV6;
+    buf[7] = 64;
+}
+
+/* Packets as read from a raw socket: IPv4 ones with the IP header, IPv6 ones without */
+static std::vector<char> ip4_echo_reply() {
+    std::vector<char> packet(Inet4::min_ip_hdr_len + 8 + PAYLOAD_LEN, 0);
+    put_ip4(packet.data());
+    put_echo(packet.data() + Inet4::min_ip_hdr_len, ICMP_ECHOREPLY, 0x1234, 0x5678);
+    return packet;
+}
+
+static std::vector<char> ip4_time_exceeded() {
+    std::vector<char> packet(2 * Inet4::min_ip_hdr_len + 2 * 8 + PAYLOAD_LEN, 0);
+    put_ip4(packet.data());
+    packet[Inet4::min_ip_hdr_len] = ICMP4_TIME_EXCEEDED;
+    put_ip4(packet.data() + Inet4::min_ip_hdr_len + 8);
+    put_echo(packet.data() + 2 * Inet4::min_ip_hdr_len + 8, ICMP_ECHO, 0x1234, 0x5678);
+    return packet;
+}
+
+static std::vector<char> ip6_echo_reply() {
+    std::vector<char> packet(8 + PAYLOAD_LEN, 0);
+    put_echo(packet.data(), ICMP6_ECHO_REPLY, 0x1234, 0x5678);
+    return packet;
+}
+
+static std::vector<char> ip6_time_exceeded() {
+    std::vector<char> packet(8 + Inet6::min_ip_hdr_len + 8 + PAYLOAD_LEN, 0);
+    packet[0] = ICMP6_TIME_EXCEEDED_TYPE;
+    put_ip6(packet.data() + 8);
+    put_echo(packet.data() + 8 + Inet6::min_ip_hdr_len, ICMP6_ECHO_REQUEST, 0x1234, 0x5678);
+    return packet;
+}
+
+/* Function runs op iterations times and returns the time per iteration in ns */
+template <typename Op>
+static double measure(size_t iterations, Op op) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < iterations; ++i) {
+        op(i);
+    }
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+/* Function parses packet iterations times with the view of Family */
+template <typename Family>
+static double measure_parse(size_t iterations, const std::vector<char> &packet) {
+    return measure(iterations, [&packet](size_t) {
+        IcmpReplyView<Family> reply(packet.data(), packet.size());
+        if (reply.is_valid()) {
+            sink = sink + reply.get_tag();
+        }
+    });
+}
+
+/* Function patches a probe of Family iterations times, with a new tag and cookie each time */
+template <typename Family>
+static double measure_patch(size_t iterations) {
+    ProbeTemplate<Family> probe(std::vector<char>(PAYLOAD_LEN - 4, 'x'));
+
+    std::vector<char> packet(probe.get_length());
+    probe.fill(packet.data(), 1);
+
+    return measure(iterations, [&probe, &packet](size_t i) {
+        probe.patch(packet.data(), static_cast<u_int32_t>(i), static_cast<u_int32_t>(i) * 2654435761u);
+        sink = sink + static_cast<u_int8_t>(packet[2]);
+    });
+}
+
+/* Function prints a row of the table, ns per operation of both families */
+static void print_row(const std::string &name, double ns4, double ns6) {
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << ns4 << std::setw(10) << ns6 << std::endl;
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : DEF_ITERATIONS;
+    if (iterations == 0) {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(20) << "ns/op" << std::right
+              << std::setw(10) << "Inet4" << std::setw(10) << "Inet6" << std::endl;
+
+    print_row("parse echo reply", measure_parse<Inet4>(iterations, ip4_echo_reply()),
+              measure_parse<Inet6>(iterations, ip6_echo_reply()));
+    print_row("parse time exceeded", measure_parse<Inet4>(iterations, ip4_time_exceeded()),
+              measure_parse<Inet6>(iterations, ip6_time_exceeded()));
+    print_row("patch", measure_patch<Inet4>(iterations), measure_patch<Inet6>(iterations));
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef DEST_FEED_H
+#define DEST_FEED_H
+
+#include "multi_traceroute.h"
+#include "net/EventLoop.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+/*
+ * Class DestFeed passes destinations of one address family from the resolver to the
+ * prober. Destinations are appended as soon as their lookup finishes; close() is called
+ * once the resolver is done. Every change is signalled through a Notifier, so the
+ * prober's event loop can watch the feed with the sockets.
+ */
+class DestFeed {
+public:
+    void push(const DestInfo &dest) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        items_.push_back(dest);
+        notifier_.notify();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notifier_.notify();
+    }
+
+    /*
+     * Method moves destinations pushed since the last call to the end of dest. Returns
+     * false if no more destinations will ever come.
+     */
+    bool fetch(std::vector<DestInfo> &dest) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        dest.insert(dest.end(), items_.begin(), items_.end());
+        items_.clear();
+
+        return !closed_;
+    }
+
+    /*
+     * Method moves at most max of the oldest destinations to the end of dest. Returns false
+     * if the feed is closed and has nothing left.
+     */
+    bool fetch(std::vector<DestInfo> &dest, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t count = std::min(max, items_.size());
+        dest.insert(dest.end(), items_.begin(), items_.begin() + count);
+        items_.erase(items_.begin(), items_.begin() + count);
+
+        return !closed_ || !items_.empty();
+    }
+
+    /*
+     * Method moves at most max of the newest destinations, but no more than half of those
+     * waiting (rounded up), to the end of dest. Used by another consumer which ran out of
+     * its own destinations; the owner keeps taking the oldest ones. Returns the number moved.
+     */
+    size_t steal(std::vector<DestInfo> &dest, size_t max) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t count = std::min(max, (items_.size() + 1) / 2);
+        dest.insert(dest.end(), items_.end() - count, items_.end());
+        items_.resize(items_.size() - count);
+
+        return count;
+    }
+
+    /* Descriptor becomes readable after a push or close, see Notifier::consume */
+    Notifier &get_notifier() {
+        return notifier_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<DestInfo> items_;
+    bool closed_ = false;
+
+    Notifier notifier_;
+};
+
+#endif // DEST_FEED_H
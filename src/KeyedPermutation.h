@@ -0,0 +1,70 @@
+#ifndef KEYED_PERMUTATION_H
+#define KEYED_PERMUTATION_H
+
+#include "net/Hash.h"
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Class KeyedPermutation is a pseudo-random permutation of 0 ... size - 1 chosen by
+ * a key. The i-th element is computed on demand, so walking the permutation needs no
+ * memory but a counter.
+ *
+ * It is a balanced Feistel network on the smallest domain of 2^(2h) numbers that
+ * covers size, elements outside of the range are encrypted again until they fall into
+ * it (cycle walking). The domain is less than 4 times larger than size, so that takes
+ * at most a few rounds on average.
+ */
+class KeyedPermutation {
+public:
+    KeyedPermutation(u_int64_t size, u_int64_t key) : size_(size) {
+        while ((u_int64_t(1) << (2 * half_bits_)) < size_ && half_bits_ < 31) {
+            ++half_bits_;
+        }
+
+        half_mask_ = (u_int64_t(1) << half_bits_) - 1;
+
+        for (int r = 0; r < ROUNDS; ++r) {
+            keys_[r] = mix32(static_cast<u_int32_t>(key >> (r % 2 * 32)) + r * 0x9e3779b9);
+        }
+    }
+
+    u_int64_t get_size() const {
+        return size_;
+    }
+
+    /* i-th element of the permutation, i has to be less than size */
+    u_int64_t at(u_int64_t i) const {
+        u_int64_t x = i;
+
+        do {
+            x = encrypt_(x);
+        } while (x >= size_);
+
+        return x;
+    }
+
+private:
+    static constexpr int ROUNDS = 4;
+
+    u_int64_t size_;
+    int half_bits_ = 1;
+    u_int64_t half_mask_;
+    u_int32_t keys_[ROUNDS];
+
+    u_int64_t encrypt_(u_int64_t x) const {
+        u_int64_t left = x >> half_bits_, right = x & half_mask_;
+
+        for (int r = 0; r < ROUNDS; ++r) {
+            u_int64_t next = left ^ (mix32(static_cast<u_int32_t>(right) ^ keys_[r]) & half_mask_);
+            left = right;
+            right = next;
+        }
+
+        return (left << half_bits_) | right;
+    }
+};
+
+#endif // KEYED_PERMUTATION_H
@@ -0,0 +1,85 @@
+#ifndef PROBE_CODEC_H
+#define PROBE_CODEC_H
+
+#include "net/Hash.h"
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Class ProbeCodec identifies probes of one address family.
+ *
+ * ICMP ID and SEQ are used together as a single 32 bit tag (ID in the upper half).
+ * Every probe of the run has an index
+ *      k = dest_index * probes_per_dest + (ttl - start_ttl) * probes + p
+ * and its tag is
+ *      tag = tag_offset + k    (mod 2^32)
+ * with a random tag_offset. A reply is matched in O(1) by subtracting the offset and
+ * checking the result against the number of probes of the run, so runs of
+ * 2^32 / probes_per_dest destinations (millions for the default 30 hops x 3 probes)
+ * are supported.
+ *
+ * The payload additionally carries a 32 bit cookie, a keyed hash of the tag and of the
+ * generation of the destination index (bumped whenever the index is reused by a new
+ * destination). Echo replies return the whole payload and errors usually quote enough
+ * of it; if the cookie is there it has to match. Only errors from routers which quote
+ * the bare minimum of 8 bytes are matched by the tag alone.
+ */
+class ProbeCodec {
+public:
+    ProbeCodec(u_int32_t tag_offset, u_int32_t key, size_t dest_count, int ttls, int probes) :
+        tag_offset_(tag_offset), key_(key), dest_count_(dest_count), probes_(probes),
+        probes_per_dest_(ttls * probes), probe_count_(dest_count * ttls * probes) { }
+
+    /* Tags of the run's probes are tag_offset ... tag_offset + probe_count - 1 (mod 2^32) */
+    u_int32_t get_tag_offset() const {
+        return tag_offset_;
+    }
+
+    u_int32_t get_probe_count() const {
+        return probe_count_;
+    }
+
+    size_t get_dest_count() const {
+        return dest_count_;
+    }
+
+    u_int32_t get_key() const {
+        return key_;
+    }
+
+    /* probe_ind is (ttl - start_ttl) * probes + p */
+    u_int32_t encode(size_t dest_ind, int probe_ind) const {
+        return tag_offset_ + static_cast<u_int32_t>(dest_ind * probes_per_dest_ + probe_ind);
+    }
+
+    /* Returns false if tag does not belong to any probe of the run */
+    bool decode(u_int32_t tag, size_t &dest_ind, int &ttl_ind, int &probe) const {
+        u_int32_t k = tag - tag_offset_;
+
+        if (k >= probe_count_) {
+            return false;
+        }
+
+        dest_ind = k / probes_per_dest_;
+        u_int32_t rem = k % probes_per_dest_;
+        ttl_ind = rem / probes_;
+        probe = rem % probes_;
+
+        return true;
+    }
+
+    u_int32_t cookie(u_int32_t tag, u_int32_t generation) const {
+        return mix32(tag ^ key_ ^ (generation * 0x9e3779b9));
+    }
+
+private:
+    u_int32_t tag_offset_;
+    u_int32_t key_;
+    size_t dest_count_;
+    u_int32_t probes_;
+    u_int32_t probes_per_dest_;
+    u_int32_t probe_count_;
+};
+
+#endif // PROBE_CODEC_H
@@ -0,0 +1,179 @@
+#include "ProbeTable.h"
+
+#include <netinet/in.h>
+#include <algorithm>
+
+using std::vector;
+
+constexpr u_int8_t ProbeTable::NO_REPLY;
+constexpr u_int8_t ProbeTable::SKIPPED;
+constexpr u_int8_t ProbeTable::TRUNCATED;
+constexpr u_int8_t ProbeTable::OUT_OF_RANGE;
+constexpr u_int32_t ProbeTable::RELEASED;
+
+/* Raw IP address bytes, the key of the table of hops */
+static std::string ip_key(const Address &address) {
+    const sockaddr *sa = address.get_sockaddr_ptr();
+
+    if (sa->sa_family == AF_INET6) {
+        const in6_addr &ip = reinterpret_cast<const sockaddr_in6 *>(sa)->sin6_addr;
+        return std::string(reinterpret_cast<const char *>(&ip), sizeof (ip));
+    }
+
+    const in_addr &ip = reinterpret_cast<const sockaddr_in *>(sa)->sin_addr;
+    return std::string(reinterpret_cast<const char *>(&ip), sizeof (ip));
+}
+
+ProbeTable::ProbeTable(int ttls, int probes) :
+    ttls_(ttls), probes_(probes), epoch_(std::chrono::steady_clock::now()) { }
+
+u_int32_t ProbeTable::take_row_() {
+    size_t slots = static_cast<size_t>(ttls_) * probes_;
+
+    if (free_rows_.empty()) {
+        u_int32_t row = time_.size() / std::max<size_t>(slots, 1);
+
+        time_.resize(time_.size() + slots, 0);
+        status_.resize(status_.size() + slots, NO_REPLY);
+        hop_.resize(hop_.size() + slots, 0);
+
+        return row;
+    }
+
+    u_int32_t row = free_rows_.back();
+    free_rows_.pop_back();
+
+    std::fill_n(time_.begin() + row * slots, slots, 0);
+    std::fill_n(status_.begin() + row * slots, slots, NO_REPLY);
+    std::fill_n(hop_.begin() + row * slots, slots, 0);
+
+    return row;
+}
+
+void ProbeTable::add_dest() {
+    row_.push_back(take_row_());
+    ++dest_count_;
+}
+
+void ProbeTable::renew(size_t dest_ind) {
+    row_[dest_ind] = take_row_();
+}
+
+void ProbeTable::release(size_t dest_ind) {
+    size_t slots = static_cast<size_t>(ttls_) * probes_;
+    size_t first = slot(dest_ind, 0, 0);
+
+    for (size_t s = first; s < first + slots; ++s) {
+        if (!did_arrive(s) || --hop_refs_[hop_[s]] > 0) {
+            continue;
+        }
+
+        hop_index_.erase(ip_key(hops_[hop_[s]]));
+        free_hops_.push_back(hop_[s]);
+    }
+
+    free_rows_.push_back(row_[dest_ind]);
+    row_[dest_ind] = RELEASED;
+}
+
+bool ProbeTable::set_reply(size_t slot,
+                           IcmpRespStatus status,
+                           const Address &offender,
+                           std::chrono::steady_clock::time_point recv_time)
+{
+    if (!is_pending(slot)) {
+        return false;
+    }
+
+    // Unsigned difference is right even if the send time wrapped around
+    time_[slot] = micros_(recv_time) - time_[slot];
+    status_[slot] = static_cast<u_int8_t>(status);
+
+    u_int32_t hop = free_hops_.empty() ? hops_.size() : free_hops_.back();
+    auto inserted = hop_index_.emplace(ip_key(offender), hop);
+
+    if (inserted.second) {
+        if (free_hops_.empty()) {
+            hops_.push_back(offender);
+            hop_refs_.push_back(0);
+        } else {
+            free_hops_.pop_back();
+            hops_[hop] = offender;
+        }
+    }
+
+    hop_[slot] = inserted.first->second;
+    ++hop_refs_[hop_[slot]];
+
+    return inserted.second;
+}
+
+void ProbeTable::append(const ProbeTable &other) {
+    size_t slots = static_cast<size_t>(ttls_) * probes_;
+
+    for (size_t d = 0; d < other.row_.size(); ++d) {
+        if (other.is_released(d)) {
+            row_.push_back(RELEASED);
+            ++dest_count_;
+            continue;
+        }
+
+        add_dest();
+
+        size_t from = other.slot(d, 0, 0);
+        size_t to = slot(dest_count_ - 1, 0, 0);
+
+        for (size_t s = 0; s < slots; ++s) {
+            status_[to + s] = other.status_[from + s];
+
+            if (!other.did_arrive(from + s)) {
+                continue;
+            }
+
+            // Offender goes through the table of hops of this table
+            u_int32_t hop = free_hops_.empty() ? hops_.size() : free_hops_.back();
+            const Address &offender = other.hops_[other.hop_[from + s]];
+            auto inserted = hop_index_.emplace(ip_key(offender), hop);
+
+            if (inserted.second) {
+                if (free_hops_.empty()) {
+                    hops_.push_back(offender);
+                    hop_refs_.push_back(0);
+                } else {
+                    free_hops_.pop_back();
+                    hops_[hop] = offender;
+                }
+            }
+
+            time_[to + s] = other.time_[from + s];
+            hop_[to + s] = inserted.first->second;
+            ++hop_refs_[hop_[to + s]];
+        }
+    }
+}
+
+void ProbeTable::reorder(const vector<size_t> &order) {
+    // Only the rows are permuted, probes stay where they are
+    vector<u_int32_t> row(order.size());
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        row[i] = row_[order[i]];
+    }
+
+    row_.swap(row);
+}
+
+size_t ProbeTable::memory_usage() const {
+    size_t bytes = (row_.capacity() + free_rows_.capacity()) * sizeof (u_int32_t)
+                 + time_.capacity() * sizeof (u_int32_t)
+                 + status_.capacity() * sizeof (u_int8_t)
+                 + hop_.capacity() * sizeof (u_int32_t)
+                 + hops_.capacity() * sizeof (Address)
+                 + (hop_refs_.capacity() + free_hops_.capacity()) * sizeof (u_int32_t);
+
+    // Every map node holds the key, the value and a pointer, the buckets one pointer each
+    bytes += hop_index_.size() * (sizeof (std::string) + sizeof (u_int32_t) + 2 * sizeof (void *))
+           + hop_index_.bucket_count() * sizeof (void *);
+
+    return bytes;
+}
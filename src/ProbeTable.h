@@ -0,0 +1,201 @@
+#ifndef PROBE_TABLE_H
+#define PROBE_TABLE_H
+
+#include "net/Address.h"
+#include "net/enums.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Class ProbeTable stores results of all probes of one address family. Every destination
+ * owns a row of ttls * probes slots, a probe is identified by its slot
+ * row * ttls * probes + ttl_ind * probes + p, and every field has its own contiguous
+ * array (struct of arrays):
+ *   - time_   - send time in microseconds since the table was created (mod 2^32) until
+ *               a reply arrives, then the round trip time in microseconds
+ *   - status_ - IcmpRespStatus of the reply, NO_REPLY or why the probe was not sent
+ *               (SKIPPED, TRUNCATED or OUT_OF_RANGE)
+ *   - hop_    - index of the offender in the table of hops
+ * That is 9 bytes per probe. Every offender is stored once in the table of hops, so
+ * hostnames are filled in per hop and not per probe.
+ *
+ * Rows of released destinations are reused by destinations added later, so a run which
+ * releases finished destinations (streaming output) needs rows only for those in flight.
+ * The index of a released destination may be reused as well, see renew(). Hops are
+ * counted by the probes referring to them and forgotten once none is left.
+ */
+class ProbeTable {
+public:
+    ProbeTable() : ProbeTable(0, 0) { }
+    ProbeTable(int ttls, int probes);
+
+    /* Method gives a row to a new destination, none of its probes is sent yet */
+    void add_dest();
+
+    /* Method frees the row of a finished destination, its slots must not be used anymore */
+    void release(size_t dest_ind);
+
+    /* Method gives a fresh row to a released destination index, which is reused by a new destination */
+    void renew(size_t dest_ind);
+
+    bool is_released(size_t dest_ind) const {
+        return row_[dest_ind] == RELEASED;
+    }
+
+    size_t get_dest_count() const {
+        return dest_count_;
+    }
+
+    int get_ttls() const {
+        return ttls_;
+    }
+
+    int get_probes() const {
+        return probes_;
+    }
+
+    size_t slot(size_t dest_ind, int ttl_ind, int probe) const {
+        return (static_cast<size_t>(row_[dest_ind]) * ttls_ + ttl_ind) * probes_ + probe;
+    }
+
+    /*
+     * Methods set_sent and set_* below leave a probe which got a reply alone, its round
+     * trip time and hop stay as they are.
+     */
+    void set_sent(size_t slot, std::chrono::steady_clock::time_point send_time) {
+        if (!did_arrive(slot)) {
+            time_[slot] = micros_(send_time);
+        }
+    }
+
+    /*
+     * Method records a reply to a sent probe. Replies to a probe which is not pending (got
+     * a reply already or was left out) are ignored. Returns true if the offender was not
+     * seen before.
+     */
+    bool set_reply(size_t slot, IcmpRespStatus status, const Address &offender,
+                   std::chrono::steady_clock::time_point recv_time);
+
+    /* Method marks a probe which will not be sent, its hop is known from another route */
+    void set_skipped(size_t slot) {
+        if (!did_arrive(slot)) {
+            status_[slot] = SKIPPED;
+        }
+    }
+
+    /* Method marks a probe which will not be sent, the route went silent before it (gap limit) */
+    void set_truncated(size_t slot) {
+        if (!did_arrive(slot)) {
+            status_[slot] = TRUNCATED;
+        }
+    }
+
+    /* Method marks a probe which will not be sent, it is past the destination's estimated distance */
+    void set_out_of_range(size_t slot) {
+        if (!did_arrive(slot)) {
+            status_[slot] = OUT_OF_RANGE;
+        }
+    }
+
+    bool did_arrive(size_t slot) const {
+        return status_[slot] < OUT_OF_RANGE;
+    }
+
+    bool was_skipped(size_t slot) const {
+        return status_[slot] == SKIPPED;
+    }
+
+    bool was_truncated(size_t slot) const {
+        return status_[slot] == TRUNCATED;
+    }
+
+    bool was_out_of_range(size_t slot) const {
+        return status_[slot] == OUT_OF_RANGE;
+    }
+
+    /* True if the probe got no reply and was not left out, sent or not */
+    bool is_pending(size_t slot) const {
+        return status_[slot] == NO_REPLY;
+    }
+
+    /* Time since a sent probe without a reply went out, negative if it went out after now */
+    std::chrono::microseconds waited(size_t slot, std::chrono::steady_clock::time_point now) const {
+        return std::chrono::microseconds(static_cast<int32_t>(micros_(now) - time_[slot]));
+    }
+
+    /* Valid only for probes which got a reply */
+    IcmpRespStatus get_status(size_t slot) const {
+        return IcmpRespStatus(status_[slot]);
+    }
+
+    u_int32_t get_rtt_us(size_t slot) const {
+        return time_[slot];
+    }
+
+    const Address &get_offender(size_t slot) const {
+        return hops_[hop_[slot]];
+    }
+
+    Address &get_offender(size_t slot) {
+        return hops_[hop_[slot]];
+    }
+
+    /* Distinct offenders; after a release, entries of forgotten hops are stale */
+    std::vector<Address> &get_hops() {
+        return hops_;
+    }
+
+    /*
+     * Method adds the destinations of other (of the same ttls and probes) after those of this
+     * table, their round trip times, statuses and hops. Probes which got no reply lose their
+     * send time.
+     */
+    void append(const ProbeTable &other);
+
+    /* Method moves destination order[i] to position i */
+    void reorder(const std::vector<size_t> &order);
+
+    /* Approximate heap memory held by the table in bytes */
+    size_t memory_usage() const;
+
+private:
+    static constexpr u_int8_t NO_REPLY = 0xff;
+    static constexpr u_int8_t SKIPPED = 0xfe;
+    static constexpr u_int8_t TRUNCATED = 0xfd;
+    static constexpr u_int8_t OUT_OF_RANGE = 0xfc;
+    static constexpr u_int32_t RELEASED = 0xffffffff;
+
+    /* Method returns a free row (a new one if there is none) with no probe sent */
+    u_int32_t take_row_();
+
+    u_int32_t micros_(std::chrono::steady_clock::time_point time) const {
+        return static_cast<u_int32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(time - epoch_).count());
+    }
+
+    int ttls_;
+    int probes_;
+    size_t dest_count_ = 0;
+    std::chrono::steady_clock::time_point epoch_;
+
+    // Row of every destination and rows of released destinations
+    std::vector<u_int32_t> row_;
+    std::vector<u_int32_t> free_rows_;
+
+    std::vector<u_int32_t> time_;
+    std::vector<u_int8_t> status_;
+    std::vector<u_int32_t> hop_;
+
+    // Offenders, number of probes referring to them and their indices keyed by the raw IP
+    std::vector<Address> hops_;
+    std::vector<u_int32_t> hop_refs_;
+    std::vector<u_int32_t> free_hops_;
+    std::unordered_map<std::string, u_int32_t> hop_index_;
+};
+
+#endif // PROBE_TABLE_H
@@ -0,0 +1,1164 @@
+#include "Prober.h"
+#include "ProbeCodec.h"
+#include "multi_traceroute.h"
+#include "DestFeed.h"
+#include "net/Address.h"
+#include "net/Socket.h"
+#include "net/UringSocket.h"
+#include "net/PacketRing.h"
+#include "net/ProbeTemplate.h"
+#include "net/IcmpFilter.h"
+#include "net/IcmpReplyView.h"
+#include "net/ReverseResolver.h"
+#include "net/Hash.h"
+#include "net/enums.h"
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <system_error>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <algorithm>
+
+constexpr int DEF_TTL_DONE = 100;
+constexpr int RECV_BUF_SIZE = 1500;
+
+// Maximum number of packets received by a single recvmmsg call
+constexpr size_t RECV_BATCH_MAX = 64;
+
+// Destinations a shard keeps in its passes, it takes more when half of them are done
+constexpr size_t SHARD_INTAKE = 1024;
+
+// Replies the receiving thread may publish before the event loop applies them
+constexpr size_t REPLY_RING_SIZE = 4096;
+
+// Event loop tokens of the receiving thread
+constexpr int SOCKET_TOKEN = 0;
+constexpr int STOP_TOKEN = 1;
+
+// Socket buffer big enough to hold a burst of replies between two recvmmsg calls
+constexpr int RECV_SOCK_BUF_SIZE = 4 * 1024 * 1024;
+
+// Round trip time of a destination with no reply yet
+constexpr u_int32_t NO_RTT = 0xffffffff;
+
+// State of a destination's distance probe. Once it answered or timed out (PROBED), late
+// replies to it must not be taken for replies to the probe of its slot, until that is sent.
+constexpr u_int8_t DISTANCE_UNPROBED = 0;
+constexpr u_int8_t DISTANCE_PENDING = 1;
+constexpr u_int8_t DISTANCE_PROBED = 2;
+constexpr u_int8_t DISTANCE_KNOWN = 3;
+
+// Hops probed past the estimated distance, the route there may be longer than the way back
+constexpr int DISTANCE_SLACK = 2;
+
+// Stop bits of a doubletree destination
+constexpr u_int8_t FORWARD_STOPPED = 1;
+constexpr u_int8_t BACKWARD_STOPPED = 2;
+
+// Stateless tags hold the ttl in the upper 8 bits and the send time in the lower 24
+constexpr int STATELESS_TTL_SHIFT = 24;
+constexpr u_int32_t STATELESS_TIME_MASK = 0xffffff;
+
+using std::vector;
+
+/* Every probe carries message 'abraham' */
+inline vector<char> probe_payload() {
+    return {'a', 'b', 'r', 'a', 'h', 'a', 'm'};
+}
+
+/*
+ * Hops travelled by a reply which arrived with hop_limit, assuming the sender started with
+ * the smallest common initial TTL (64, 128 or 255) that is at least hop_limit
+ */
+inline int hop_distance(int hop_limit) {
+    int initial = (hop_limit <= 64) ? 64 : (hop_limit <= 128) ? 128 : 255;
+    return initial - hop_limit + 1;
+}
+
+template <typename Family>
+FamilyProber<Family>::FamilyProber(DestFeed &feed,
+                                   vector<DestInfo> &dest,
+                                   ProbeTable &probes,
+                                   ReverseResolver *reverse,
+                                   DistanceCache *distances,
+                                   SendStats &send_stats,
+                                   RecvStats &recv_stats,
+                                   const ProbeCodec &codec,
+                                   const TraceOptions &options) :
+    feed_(feed),
+    dest_(dest),
+    probes_(probes),
+    reverse_(reverse),
+    distances_(distances),
+    send_stats_(send_stats),
+    recv_stats_(recv_stats),
+    codec_(codec),
+    options_(options),
+    ttls_(options.max_ttl - options.start_ttl + 1),
+    probe_template_(probe_payload()),
+    ttl_done_(options.stateless ? 0 : codec.get_dest_count()),
+    generation_(options.stateless ? 0 : codec.get_dest_count()),
+    start_first_ttl_((options.doubletree_hop > 0) ?
+                     std::min(std::max(options.doubletree_hop, options.start_ttl), options.max_ttl) :
+                     options.start_ttl),
+    epoch_(std::chrono::steady_clock::now()),
+    replies_(REPLY_RING_SIZE),
+    recv_batch_(RECV_BATCH_MAX, RECV_BUF_SIZE)
+{
+    for (std::atomic<int> &ttl : ttl_done_) {
+        ttl.store(DEF_TTL_DONE, std::memory_order_relaxed);
+    }
+
+    for (std::atomic<u_int32_t> &generation : generation_) {
+        generation.store(0, std::memory_order_relaxed);
+    }
+
+    // Batch slots hold the template for good, send() patches just ID and SEQ
+    packet_len_ = probe_template_.get_length();
+    batch_buf_.resize(SEND_BATCH_MAX * packet_len_);
+    probe_template_.fill(batch_buf_.data(), SEND_BATCH_MAX);
+}
+
+template <typename Family>
+void FamilyProber<Family>::open_io_() {
+    bool packet_ring = false;
+
+    if (options_.packet_ring) {
+        // Ring sends through the next hop of the first destination, see PacketRing
+        try {
+            io_.reset(new PacketRing<Family>(fetched_.front().address));
+            packet_ring = true;
+        } catch (const std::runtime_error &e) {
+            std::cerr << "Warning: Could not use packet rings, falling back to raw sockets: " << e.what() << std::endl;
+        }
+    }
+
+    if (!packet_ring) {
+        Socket *sock = nullptr;
+
+        if (options_.io_uring) {
+            try {
+                sock = new UringSocket(Family::family, SocketType::Raw, Family::protocol);
+            } catch (const std::system_error &e) {
+                std::cerr << "Warning: Could not use io_uring, falling back to recvmmsg: " << e.what() << std::endl;
+            }
+        }
+
+        if (sock == nullptr) {
+            sock = new Socket(Family::family, SocketType::Raw, Family::protocol);
+        }
+
+        io_.reset(sock);
+
+        sock->set_recv_buffer_size(RECV_SOCK_BUF_SIZE);
+
+        if (options_.hop_distance) {
+            sock->set_recv_hop_limit();
+        }
+
+        // Fallback if the BPF program below cannot be attached
+        sock->set_icmp_type_filter(reply_icmp_types(Family::family));
+    }
+
+    /*
+     * A raw socket gets a copy of every ICMP message the host receives, a packet ring
+     * every packet of the family. Let the kernel drop those which are not replies to this
+     * run's probes before they are queued, so they take neither buffer space nor batch
+     * slots. parse_reply_ validates every reply anyway.
+     */
+    try {
+        if (options_.stateless) {
+            // Ttls reach 255, shifted as ints they would overflow
+            io_->attach_filter(make_reply_filter(Family::family,
+                                                 static_cast<u_int32_t>(options_.start_ttl) << STATELESS_TTL_SHIFT,
+                                                 static_cast<u_int32_t>(ttls_) << STATELESS_TTL_SHIFT,
+                                                 packet_ring));
+        } else {
+            io_->attach_filter(make_reply_filter(Family::family, codec_.get_tag_offset(), codec_.get_probe_count(),
+                                                 packet_ring));
+        }
+    } catch (const std::system_error &e) {
+        std::cerr << "Warning: Could not attach the reply filter: " << e.what() << std::endl;
+    }
+
+    receiver_ = std::thread(&FamilyProber::receive_loop_, this);
+}
+
+template <typename Family>
+FamilyProber<Family>::~FamilyProber() {
+    if (receiver_.joinable()) {
+        stopping_.store(true, std::memory_order_relaxed);
+        stop_.notify();
+        receiver_.join();
+    }
+}
+
+template <typename Family>
+void FamilyProber<Family>::set_siblings(const vector<DestFeed *> &siblings) {
+    siblings_ = siblings;
+}
+
+template <typename Family>
+bool FamilyProber<Family>::wants_dests() const {
+    if (siblings_.empty() || active_.size() >= SHARD_INTAKE / 2) {
+        return false;
+    }
+
+    return feed_backlog_ || (!feed_open_ && can_steal_);
+}
+
+/*
+ * Method takes at most max destinations waiting in the feeds of other shards, a part of
+ * one feed at a time. The feeds are all closed by now, so once they have nothing left
+ * they never will.
+ */
+template <typename Family>
+size_t FamilyProber<Family>::steal_(size_t max) {
+    size_t stolen = 0;
+
+    for (size_t k = 0; k < siblings_.size() && stolen < max; ++k) {
+        DestFeed *sibling = siblings_[(next_sibling_ + k) % siblings_.size()];
+        stolen += sibling->steal(fetched_, max - stolen);
+    }
+
+    // Other shards get robbed the next time
+    next_sibling_ = (next_sibling_ + 1) % siblings_.size();
+
+    if (stolen == 0 && max > 0) {
+        can_steal_ = false;
+    }
+
+    send_stats_.dests_stolen += stolen;
+    return stolen;
+}
+
+template <typename Family>
+void FamilyProber<Family>::fetch_dests() {
+    fetched_.clear();
+
+    if (siblings_.empty()) {
+        feed_open_ = feed_.fetch(fetched_);
+    } else {
+        size_t room = SHARD_INTAKE - std::min(active_.size(), SHARD_INTAKE);
+
+        feed_open_ = feed_.fetch(fetched_, room);
+        feed_backlog_ = feed_open_ && fetched_.size() == room;
+
+        if (!feed_open_ && can_steal_) {
+            steal_(room - fetched_.size());
+        }
+    }
+
+    if (!fetched_.empty() && !io_) {
+        open_io_();
+    }
+
+    // Probing starts once every destination is known, the permutation covers them all
+    if (options_.stateless) {
+        dest_.insert(dest_.end(), fetched_.begin(), fetched_.end());
+
+        if (!feed_open_ && !perm_) {
+            u_int64_t key = (u_int64_t(codec_.get_tag_offset()) << 32) | codec_.get_key();
+            perm_.reset(new KeyedPermutation(u_int64_t(dest_.size()) * ttls_ * options_.probes, key));
+        }
+
+        return;
+    }
+
+    for (DestInfo &dest : fetched_) {
+        size_t i;
+
+        if (free_dests_.empty()) {
+            i = dest_.size();
+
+            dest_.push_back(dest);
+            probes_.add_dest();
+            next_probe_.push_back(0);
+            first_ttl_.push_back(start_first_ttl_);
+            last_ttl_.push_back(options_.max_ttl);
+            distance_.push_back(options_.hop_distance ? DISTANCE_UNPROBED : DISTANCE_KNOWN);
+            stopped_.push_back(0);
+            due_.push_back(std::chrono::steady_clock::time_point::max());
+            srtt_.push_back(NO_RTT);
+            rttvar_.push_back(0);
+        } else {
+            i = free_dests_.front();
+            free_dests_.pop_front();
+
+            dest_[i] = dest;
+            probes_.renew(i);
+            next_probe_[i] = 0;
+            first_ttl_[i] = start_first_ttl_;
+            last_ttl_[i] = options_.max_ttl;
+            distance_[i] = options_.hop_distance ? DISTANCE_UNPROBED : DISTANCE_KNOWN;
+            stopped_[i] = 0;
+            srtt_[i] = NO_RTT;
+            rttvar_[i] = 0;
+
+            ttl_done_[i].store(DEF_TTL_DONE, std::memory_order_relaxed);
+            generation_[i].store(generation_[i].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Network traced by an earlier run needs no distance probe
+        int distance;
+
+        if (distances_ != nullptr &&
+            distances_->get(Family::addr_ptr(dest.address.get_sockaddr_ptr()), Family::net_prefix_len, distance)) {
+            set_range_(i, distance);
+            distance_[i] = DISTANCE_KNOWN;
+            ++send_stats_.distances_cached;
+        }
+
+        active_.push_back(i);
+    }
+}
+
+template <typename Family>
+int FamilyProber<Family>::get_fd() const {
+    return replies_ready_.get_fd();
+}
+
+template <typename Family>
+bool FamilyProber<Family>::has_work() const {
+    if (options_.stateless) {
+        return perm_ && perm_pos_ < perm_->get_size();
+    }
+
+    // Some of the active destinations may turn out to be already reached
+    return !active_.empty() && std::chrono::steady_clock::now() >= held_until_;
+}
+
+template <typename Family>
+std::chrono::steady_clock::time_point FamilyProber<Family>::get_held_until() const {
+    if (held_until_ == std::chrono::steady_clock::time_point::min()) {
+        return std::chrono::steady_clock::time_point::max();
+    }
+
+    return held_until_;
+}
+
+template <typename Family>
+bool FamilyProber<Family>::is_done() const {
+    if (options_.stateless) {
+        return perm_ && perm_pos_ == perm_->get_size();
+    }
+
+    return !feed_open_ && active_.empty();
+}
+
+/* Method adds probe p of ttl to the batch */
+template <typename Family>
+void FamilyProber<Family>::add_probe_(size_t dest_ind, int ttl, int p) {
+    u_int32_t tag = codec_.encode(dest_ind, (ttl - options_.start_ttl) * options_.probes + p);
+
+    char *packet = batch_buf_.data() + batch_.size() * packet_len_;
+    probe_template_.patch(packet, tag, codec_.cookie(tag, generation_[dest_ind].load(std::memory_order_relaxed)));
+
+    batch_.push_back(OutPacket{packet, packet_len_, &dest_[dest_ind].address, ttl});
+    batch_probes_.push_back(probes_.slot(dest_ind, ttl - options_.start_ttl, p));
+
+    // Slot of the distance probe is sent again, its replies count from now on
+    if (distance_[dest_ind] == DISTANCE_PROBED && ttl == options_.max_ttl && p == 0) {
+        distance_[dest_ind] = DISTANCE_KNOWN;
+    }
+}
+
+template <typename Family>
+void FamilyProber<Family>::flush_batch_() {
+    if (batch_.empty()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (size_t slot : batch_probes_) {
+        probes_.set_sent(slot, now);
+    }
+
+    io_->send_batch(batch_.data(), batch_.size());
+
+    send_stats_.probes_sent += batch_.size();
+    batch_.clear();
+    batch_probes_.clear();
+}
+
+/*
+ * Method sends the next max probes of the permutation. The send time goes into the
+ * tag, so nothing is recorded.
+ */
+template <typename Family>
+size_t FamilyProber<Family>::send_stateless_(size_t max) {
+    int probes_per_dest = ttls_ * options_.probes;
+    u_int32_t now = micros_(std::chrono::steady_clock::now()) & STATELESS_TIME_MASK;
+
+    while (batch_.size() < max && perm_pos_ < perm_->get_size()) {
+        u_int64_t k = perm_->at(perm_pos_++);
+        const Address &address = dest_[k / probes_per_dest].address;
+        int ttl = options_.start_ttl + static_cast<int>(k % probes_per_dest) / options_.probes;
+
+        u_int32_t tag = (static_cast<u_int32_t>(ttl) << STATELESS_TTL_SHIFT) | now;
+        // Hash of the raw address is the generation of the probe's cookie
+        u_int32_t target = fnv1a(Family::addr_ptr(address.get_sockaddr_ptr()), Family::addr_len);
+
+        char *packet = batch_buf_.data() + batch_.size() * packet_len_;
+        probe_template_.patch(packet, tag, codec_.cookie(tag, target));
+
+        batch_.push_back(OutPacket{packet, packet_len_, &address, ttl});
+    }
+
+    size_t sent = batch_.size();
+    flush_batch_();
+
+    stateless_due_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(options_.waittime);
+
+    return sent;
+}
+
+template <typename Family>
+size_t FamilyProber<Family>::send(size_t max) {
+    max = std::min(max, SEND_BATCH_MAX);
+
+    if (options_.stateless) {
+        return send_stateless_(max);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    held_until_ = std::chrono::steady_clock::time_point::min();
+    size_t sent = 0;
+
+    while (sent + batch_.size() < max) {
+        if (pass_pos_ == active_.size()) {
+            // Gap and distance checks read send times, which are recorded when the batch is flushed
+            if (options_.gap_limit > 0 || options_.hop_distance) {
+                sent += batch_.size();
+                flush_batch_();
+            }
+
+            // End of the pass, drop finished destinations
+            bool all_held = still_active_ > 0 && pass_held_ == still_active_;
+
+            active_.resize(still_active_);
+            pass_pos_ = 0;
+            still_active_ = 0;
+            pass_held_ = 0;
+
+            if (all_held) {
+                held_until_ = pass_due_;
+            }
+
+            pass_due_ = std::chrono::steady_clock::time_point::max();
+
+            if (active_.empty() || all_held) {
+                break;
+            }
+        }
+
+        size_t i = active_[pass_pos_++];
+
+        // Distance probe goes first, the range of the other probes depends on its reply
+        if (distance_[i] == DISTANCE_UNPROBED) {
+            add_probe_(i, options_.max_ttl, 0);
+            distance_[i] = DISTANCE_PENDING;
+            active_[still_active_++] = i;
+            continue;
+        }
+
+        if (distance_[i] == DISTANCE_PENDING) {
+            size_t slot = probes_.slot(i, ttls_ - 1, 0);
+            std::chrono::microseconds left = timeout_(i) - probes_.waited(slot, now);
+
+            if (left.count() > 0) {
+                pass_due_ = std::min(pass_due_, now + left);
+                active_[still_active_++] = i;
+                ++pass_held_;
+                continue;
+            }
+
+            // No reply, probe the whole range
+            distance_[i] = DISTANCE_PROBED;
+        }
+
+        int forward_end = forward_end_(i);
+
+        if (options_.doubletree_hop > 0) {
+            skip_stopped_(i);
+        }
+
+        int ttl = probe_ttl_(i, next_probe_[i]);
+        int ttl_done = ttl_done_[i].load(std::memory_order_relaxed);
+        RangeState range = RangeState::Exceeded;
+
+        if (next_probe_[i] < forward_end && ttl > last_ttl_[i] && ttl_done >= ttl) {
+            // Probes of the last hop may still wait in the batch
+            sent += batch_.size();
+            flush_batch_();
+
+            range = range_state_(i, now, pass_due_);
+
+            // Destination is farther than estimated, the whole range is probed
+            if (range == RangeState::Exceeded) {
+                last_ttl_[i] = options_.max_ttl;
+                ++send_stats_.ranges_extended;
+            }
+        }
+
+        // Last hop in the range has not answered yet
+        if (range == RangeState::Pending) {
+            active_[still_active_++] = i;
+            ++pass_held_;
+            continue;
+        }
+
+        // Rest of the forward probes would go past the estimated distance
+        if (range == RangeState::Ended) {
+            for (int pos = next_probe_[i]; pos < forward_end; ++pos) {
+                probes_.set_out_of_range(probes_.slot(i, probe_ttl_(i, pos) - options_.start_ttl, pos % options_.probes));
+            }
+
+            send_stats_.probes_out_of_range += forward_end - next_probe_[i];
+            next_probe_[i] = forward_end;
+            ttl = probe_ttl_(i, next_probe_[i]);
+        }
+
+        int p = next_probe_[i] % options_.probes;
+
+        GapState gap = GapState::Open;
+
+        if (options_.gap_limit > 0 && p == 0 && next_probe_[i] < forward_end) {
+            gap = gap_state_(i, ttl, now, pass_due_);
+        }
+
+        // Silent hops may still answer, ask again in the next pass
+        if (gap == GapState::Pending) {
+            active_[still_active_++] = i;
+            ++pass_held_;
+            continue;
+        }
+
+        // Route went silent, the rest of its forward probes would most likely get no reply
+        if (gap == GapState::Reached) {
+            for (int pos = next_probe_[i]; pos < forward_end; ++pos) {
+                probes_.set_truncated(probes_.slot(i, probe_ttl_(i, pos) - options_.start_ttl, pos % options_.probes));
+            }
+
+            send_stats_.probes_truncated += forward_end - next_probe_[i];
+            next_probe_[i] = forward_end;
+            ttl = probe_ttl_(i, next_probe_[i]);
+        }
+
+        // Destination is closer than first_ttl_, backward probing goes on from its ttl
+        if (next_probe_[i] >= forward_end && next_probe_[i] < ttls_ * options_.probes &&
+            ttl_done < ttl && ttl_done >= options_.start_ttl) {
+            next_probe_[i] = forward_end + (first_ttl_[i] - 1 - ttl_done) * options_.probes;
+            ttl = ttl_done;
+            p = 0;
+        }
+
+        // Destination is already reached (or every probe left was skipped), doubletree
+        // still probes the hops before first_ttl_
+        if (next_probe_[i] == ttls_ * options_.probes || ttl_done < ttl) {
+            if (next_probe_[i] < forward_end && forward_end < ttls_ * options_.probes) {
+                next_probe_[i] = forward_end;
+                active_[still_active_++] = i;
+            } else {
+                last_sent_.push_back(i);
+            }
+
+            continue;
+        }
+
+        add_probe_(i, ttl, p);
+
+        if (++next_probe_[i] < ttls_ * options_.probes) {
+            active_[still_active_++] = i;
+        } else {
+            last_sent_.push_back(i);
+        }
+    }
+
+    sent += batch_.size();
+    flush_batch_();
+
+    // Destinations time out after their last probe (or this batch) is out
+    auto sent_time = std::chrono::steady_clock::now();
+    for (size_t i : last_sent_) {
+        finish_at_(i, all_answered_(i) ? sent_time : sent_time + timeout_(i));
+    }
+
+    last_sent_.clear();
+
+    return sent;
+}
+
+/* Timeout of a destination's probes, RTO of RFC 6298 clamped to min_waittime ... waittime */
+template <typename Family>
+std::chrono::microseconds FamilyProber<Family>::timeout_(size_t dest_ind) const {
+    std::chrono::microseconds max_wait = std::chrono::milliseconds(options_.waittime);
+
+    if (options_.min_waittime == 0 || srtt_[dest_ind] == NO_RTT) {
+        return max_wait;
+    }
+
+    std::chrono::microseconds rto(static_cast<u_int64_t>(srtt_[dest_ind]) + 4 * static_cast<u_int64_t>(rttvar_[dest_ind]));
+    std::chrono::microseconds min_wait = std::chrono::milliseconds(options_.min_waittime);
+
+    return std::min(std::max(rto, min_wait), max_wait);
+}
+
+/* Method adds a round trip time sample to the estimate (RFC 6298, alpha 1/8, beta 1/4) */
+template <typename Family>
+void FamilyProber<Family>::update_rtt_(size_t dest_ind, u_int32_t rtt_us) {
+    if (srtt_[dest_ind] == NO_RTT) {
+        srtt_[dest_ind] = rtt_us;
+        rttvar_[dest_ind] = rtt_us / 2;
+        return;
+    }
+
+    u_int32_t srtt = srtt_[dest_ind];
+    u_int32_t diff = (srtt > rtt_us) ? srtt - rtt_us : rtt_us - srtt;
+
+    rttvar_[dest_ind] = (3 * static_cast<u_int64_t>(rttvar_[dest_ind]) + diff) / 4;
+    srtt_[dest_ind] = (7 * static_cast<u_int64_t>(srtt) + rtt_us) / 8;
+}
+
+/*
+ * True if every probe of a destination up to the ttl it was reached at got a reply or
+ * was left out, later replies would add nothing.
+ */
+template <typename Family>
+bool FamilyProber<Family>::all_answered_(size_t dest_ind) const {
+    int last_ttl = std::min(ttl_done_[dest_ind].load(std::memory_order_relaxed), options_.max_ttl);
+
+    for (int ttl = options_.start_ttl; ttl <= last_ttl; ++ttl) {
+        for (int p = 0; p < options_.probes; ++p) {
+            if (probes_.is_pending(probes_.slot(dest_ind, ttl - options_.start_ttl, p))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Method moves the finish time of a destination forward, it never postpones it */
+template <typename Family>
+void FamilyProber<Family>::finish_at_(size_t dest_ind, std::chrono::steady_clock::time_point time) {
+    if (time < due_[dest_ind]) {
+        due_[dest_ind] = time;
+        finishing_.push(FinishEntry(time, dest_ind));
+    }
+}
+
+/* Method marks the probes of a destination up to position end as skipped */
+template <typename Family>
+void FamilyProber<Family>::skip_probes_(size_t dest_ind, int end) {
+    for (int pos = next_probe_[dest_ind]; pos < end; ++pos) {
+        int ttl = probe_ttl_(dest_ind, pos);
+        probes_.set_skipped(probes_.slot(dest_ind, ttl - options_.start_ttl, pos % options_.probes));
+    }
+
+    send_stats_.probes_skipped += end - next_probe_[dest_ind];
+    next_probe_[dest_ind] = end;
+}
+
+/*
+ * Method tells whether the gap_limit forward hops right before ttl are silent. If they
+ * are still pending, due is lowered to the time the last of them times out.
+ */
+template <typename Family>
+GapState FamilyProber<Family>::gap_state_(size_t dest_ind, int ttl,
+                                          std::chrono::steady_clock::time_point now,
+                                          std::chrono::steady_clock::time_point &due) const
+{
+    if (ttl - first_ttl_[dest_ind] < options_.gap_limit) {
+        return GapState::Open;
+    }
+
+    std::chrono::microseconds timeout = timeout_(dest_ind);
+    std::chrono::microseconds left(0);
+
+    for (int gap_ttl = ttl - options_.gap_limit; gap_ttl < ttl; ++gap_ttl) {
+        for (int p = 0; p < options_.probes; ++p) {
+            size_t slot = probes_.slot(dest_ind, gap_ttl - options_.start_ttl, p);
+
+            if (probes_.did_arrive(slot)) {
+                return GapState::Open;
+            }
+
+            left = std::max(left, timeout - probes_.waited(slot, now));
+        }
+    }
+
+    if (left.count() > 0) {
+        due = std::min(due, now + left);
+        return GapState::Pending;
+    }
+
+    return GapState::Reached;
+}
+
+/* Method leaves out the rest of the forward or backward probes if the stop sets say so */
+template <typename Family>
+void FamilyProber<Family>::skip_stopped_(size_t dest_ind) {
+    int forward_end = forward_end_(dest_ind);
+
+    if ((stopped_[dest_ind] & FORWARD_STOPPED) && next_probe_[dest_ind] < forward_end) {
+        skip_probes_(dest_ind, forward_end);
+    }
+
+    if ((stopped_[dest_ind] & BACKWARD_STOPPED) && next_probe_[dest_ind] >= forward_end) {
+        skip_probes_(dest_ind, ttls_ * options_.probes);
+    }
+}
+
+/*
+ * Method adds the offender of a Time Exceeded reply to both stop sets. An entry added by
+ * another destination means the route is already known past the offender (forward) or
+ * before it (backward).
+ */
+template <typename Family>
+void FamilyProber<Family>::update_stop_sets_(const ReplyRecord &reply) {
+    size_t owner = dest_[reply.dest_ind].input_ind;
+    std::string iface(Family::addr_ptr(reply.offender.get_sockaddr_ptr()), Family::addr_len);
+
+    auto local = local_stop_.emplace(iface, owner);
+    if (reply.ttl < first_ttl_[reply.dest_ind] && !local.second && local.first->second != owner) {
+        stopped_[reply.dest_ind] |= BACKWARD_STOPPED;
+    }
+
+    iface.append(Family::addr_ptr(dest_[reply.dest_ind].address.get_sockaddr_ptr()), Family::net_prefix_len);
+
+    auto global = global_stop_.emplace(iface, owner);
+    if (reply.ttl >= first_ttl_[reply.dest_ind] && !global.second && global.first->second != owner) {
+        stopped_[reply.dest_ind] |= FORWARD_STOPPED;
+    }
+}
+
+/*
+ * Method sets the ttl range of a destination from the reply to its distance probe. Only
+ * an Echo Reply tells the distance, the destination is probed as usual otherwise.
+ */
+template <typename Family>
+void FamilyProber<Family>::set_distance_(const ReplyRecord &reply) {
+    size_t i = reply.dest_ind;
+    size_t slot = probes_.slot(i, ttls_ - 1, 0);
+
+    distance_[i] = DISTANCE_PROBED;
+    update_rtt_(i, static_cast<u_int32_t>(probes_.waited(slot, reply.recv_time).count()));
+
+    if (reply.icmp_status != IcmpRespStatus::EchoReply || reply.hop_limit <= 0) {
+        return;
+    }
+
+    set_range_(i, hop_distance(reply.hop_limit));
+}
+
+/* Method sets the ttl range of a destination which is distance hops away */
+template <typename Family>
+void FamilyProber<Family>::set_range_(size_t dest_ind, int distance) {
+    last_ttl_[dest_ind] = std::min(std::max(distance + DISTANCE_SLACK, options_.start_ttl), options_.max_ttl);
+
+    if (options_.descending) {
+        first_ttl_[dest_ind] = std::min(std::max(distance, options_.start_ttl), options_.max_ttl);
+    }
+
+    ++send_stats_.distances_estimated;
+}
+
+/*
+ * Method tells whether the route goes on past the last hop in a destination's range. If
+ * its probes are still pending, due is lowered to the time the last of them times out.
+ */
+template <typename Family>
+RangeState FamilyProber<Family>::range_state_(size_t dest_ind, std::chrono::steady_clock::time_point now,
+                                              std::chrono::steady_clock::time_point &due) const
+{
+    std::chrono::microseconds timeout = timeout_(dest_ind);
+    std::chrono::microseconds left(0);
+
+    for (int p = 0; p < options_.probes; ++p) {
+        size_t slot = probes_.slot(dest_ind, last_ttl_[dest_ind] - options_.start_ttl, p);
+
+        if (probes_.did_arrive(slot) && probes_.get_status(slot) == IcmpRespStatus::TimeExceeded) {
+            return RangeState::Exceeded;
+        }
+
+        if (probes_.is_pending(slot)) {
+            left = std::max(left, timeout - probes_.waited(slot, now));
+        }
+    }
+
+    if (left.count() > 0) {
+        due = std::min(due, now + left);
+        return RangeState::Pending;
+    }
+
+    return RangeState::Ended;
+}
+
+/*
+ * Method stores the distance of a retired destination in the cache: the first ttl which
+ * reached it, or the last one which answered at all.
+ */
+template <typename Family>
+void FamilyProber<Family>::record_distance_(size_t dest_ind) {
+    int last_arrived = 0;
+
+    for (int ttl = options_.start_ttl; ttl <= options_.max_ttl; ++ttl) {
+        for (int p = 0; p < options_.probes; ++p) {
+            size_t slot = probes_.slot(dest_ind, ttl - options_.start_ttl, p);
+
+            if (!probes_.did_arrive(slot)) {
+                continue;
+            }
+
+            if (probes_.get_status(slot) != IcmpRespStatus::TimeExceeded) {
+                distances_->put(Family::addr_ptr(dest_[dest_ind].address.get_sockaddr_ptr()),
+                                Family::net_prefix_len, ttl, true);
+                return;
+            }
+
+            last_arrived = ttl;
+        }
+    }
+
+    if (last_arrived > 0) {
+        distances_->put(Family::addr_ptr(dest_[dest_ind].address.get_sockaddr_ptr()),
+                        Family::net_prefix_len, last_arrived, false);
+    }
+}
+
+template <typename Family>
+void FamilyProber<Family>::apply_replies() {
+    replies_ready_.consume();
+
+    if (receiver_failed_.load(std::memory_order_acquire)) {
+        std::rethrow_exception(receiver_error_);
+    }
+
+    ReplyRecord reply;
+    while (options_.stateless && replies_.try_pop(reply)) {
+        decoded_.push_back(DecodedReply{reply.target, reply.ttl, reply.offender, reply.icmp_status, reply.rtt_us});
+        ++recv_stats_.probes_matched;
+
+        if (reverse_ != nullptr) {
+            reverse_->submit(reply.offender);
+        }
+    }
+
+    while (replies_.try_pop(reply)) {
+        // Tag range covers destinations which have not been fetched yet, late replies
+        // may belong to a retired destination or to the previous user of the index
+        if (reply.dest_ind >= dest_.size() || probes_.is_released(reply.dest_ind) ||
+            reply.generation != generation_[reply.dest_ind].load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        // Late or duplicated reply to the distance probe, its slot has not been sent again
+        if (distance_[reply.dest_ind] == DISTANCE_PROBED && reply.ttl == options_.max_ttl && reply.probe_ind == 0) {
+            continue;
+        }
+
+        ++recv_stats_.probes_matched;
+
+        // Nothing but the distance probe is out while it is pending
+        if (distance_[reply.dest_ind] == DISTANCE_PENDING) {
+            set_distance_(reply);
+            held_until_ = std::chrono::steady_clock::time_point::min();
+            continue;
+        }
+
+        size_t slot = probes_.slot(reply.dest_ind, reply.ttl - options_.start_ttl, reply.probe_ind);
+        bool first_reply = probes_.is_pending(slot);
+        bool new_hop = probes_.set_reply(slot, reply.icmp_status, reply.offender, reply.recv_time);
+
+        if (first_reply) {
+            update_rtt_(reply.dest_ind, probes_.get_rtt_us(slot));
+
+            // Finishing destination with nothing left to wait for is done right away
+            if (due_[reply.dest_ind] != std::chrono::steady_clock::time_point::max() &&
+                all_answered_(reply.dest_ind)) {
+                finish_at_(reply.dest_ind, reply.recv_time);
+            }
+        }
+
+        // Reply may end a gap, held destinations are worth another look
+        held_until_ = std::chrono::steady_clock::time_point::min();
+
+        if (options_.doubletree_hop > 0 && reply.icmp_status == IcmpRespStatus::TimeExceeded) {
+            update_stop_sets_(reply);
+        }
+
+        if (new_hop && reverse_ != nullptr) {
+            reverse_->submit(reply.offender);
+        }
+    }
+}
+
+template <typename Family>
+void FamilyProber<Family>::finish() {
+    if (!receiver_.joinable()) {
+        return;
+    }
+
+    stopping_.store(true, std::memory_order_relaxed);
+    stop_.notify();
+    receiver_.join();
+
+    apply_replies();
+
+    recv_stats_.packets_received += receiver_stats_.packets_received;
+    recv_stats_.replies_rejected += receiver_stats_.replies_rejected;
+    recv_stats_.recv_calls += receiver_stats_.recv_calls;
+    recv_stats_.max_batch = std::max(recv_stats_.max_batch, receiver_stats_.max_batch);
+}
+
+template <typename Family>
+std::chrono::steady_clock::time_point FamilyProber<Family>::retire(std::chrono::steady_clock::time_point now,
+                                                                   RouteSink *sink)
+{
+    if (options_.stateless) {
+        for (const DecodedReply &reply : decoded_) {
+            sink->reply_decoded(reply);
+        }
+
+        decoded_.clear();
+
+        return (is_done() && stateless_due_ > now) ? stateless_due_ : std::chrono::steady_clock::time_point::max();
+    }
+
+    while (!finishing_.empty() && finishing_.top().first <= now) {
+        FinishEntry entry = finishing_.top();
+        size_t i = entry.second;
+        finishing_.pop();
+
+        if (due_[i] != entry.first) {
+            continue;
+        }
+
+        due_[i] = std::chrono::steady_clock::time_point::max();
+
+        if (distances_ != nullptr) {
+            record_distance_(i);
+        }
+
+        if (sink != nullptr) {
+            sink->route_done(dest_[i], probes_, i);
+            probes_.release(i);
+            free_dests_.push_back(i);
+        }
+    }
+
+    // Stale entries would only wake the event loop for nothing
+    while (!finishing_.empty() && due_[finishing_.top().second] != finishing_.top().first) {
+        finishing_.pop();
+    }
+
+    return finishing_.empty() ? std::chrono::steady_clock::time_point::max() : finishing_.top().first;
+}
+
+template <typename Family>
+void FamilyProber<Family>::receive_loop_() {
+    try {
+        EventLoop loop;
+        loop.add(io_->get_fd(), SOCKET_TOKEN);
+        loop.add(stop_.get_fd(), STOP_TOKEN);
+
+        vector<int> tokens;
+
+        // An io_uring arms its receive here, so that the kernel reads packets for this thread
+        receive_batches_();
+
+        while (true) {
+            loop.wait(tokens, -1);
+
+            for (int token : tokens) {
+                if (token == STOP_TOKEN) {
+                    return;
+                }
+
+                receive_batches_();
+            }
+        }
+    } catch (...) {
+        receiver_error_ = std::current_exception();
+        receiver_failed_.store(true, std::memory_order_release);
+        replies_ready_.notify();
+    }
+}
+
+/*
+ * Method reads the socket until it is drained and publishes matched replies, waking
+ * the event loop once per batch.
+ */
+template <typename Family>
+void FamilyProber<Family>::receive_batches_() {
+    while (true) {
+        size_t n_packets = io_->recv_batch(recv_batch_);
+
+        if (n_packets == 0) {
+            return;
+        }
+
+        ++receiver_stats_.recv_calls;
+        receiver_stats_.packets_received += n_packets;
+        receiver_stats_.max_batch = std::max(receiver_stats_.max_batch, n_packets);
+
+        bool published = false;
+        ReplyRecord reply;
+
+        for (size_t k = 0; k < n_packets; ++k) {
+            if (!parse_reply_(recv_batch_.get_packet_ptr(k), recv_batch_.get_length(k),
+                              recv_batch_.get_from(k), recv_batch_.get_hop_limit(k), recv_batch_.get_recv_time(k), reply)) {
+                continue;
+            }
+
+            // Ring is full, let the event loop catch up
+            while (!replies_.try_push(reply)) {
+                if (stopping_.load(std::memory_order_relaxed)) {
+                    return;
+                }
+
+                replies_ready_.notify();
+                std::this_thread::yield();
+            }
+
+            published = true;
+        }
+
+        if (published) {
+            replies_ready_.notify();
+        }
+
+        // Socket (or ring) is drained
+        if (n_packets < recv_batch_.capacity()) {
+            return;
+        }
+    }
+}
+
+/*
+ * Method parses a single received packet. If it is a useful reply to one of our probes
+ * (based on ID and SEQ), reply is filled and true is returned. Runs in the receiving thread.
+ */
+template <typename Family>
+bool FamilyProber<Family>::parse_reply_(const char *recv_buf,
+                          int n_bytes,
+                          const Address &from,
+                          int hop_limit,
+                          std::chrono::steady_clock::time_point recv_time,
+                          ReplyRecord &reply)
+{
+    IcmpReplyView<Family> view(recv_buf, n_bytes);
+
+    if (!view.is_valid()) {
+        return false;
+    }
+
+    if (options_.stateless) {
+        return parse_stateless_(view, from, recv_time, reply);
+    }
+
+    IcmpRespStatus icmp_status = view.get_resp_status();
+
+    u_int32_t tag = view.get_tag();
+    size_t dest_ind;
+    int ttl_ind, probe_ind;
+
+    if (!codec_.decode(tag, dest_ind, ttl_ind, probe_ind)) {
+        ++receiver_stats_.replies_rejected;
+        return false;
+    }
+
+    // Cookie has to match whenever the reply carries it, echo replies always do
+    u_int32_t generation = generation_[dest_ind].load(std::memory_order_acquire);
+    u_int32_t cookie;
+
+    if (view.read_echo32(ProbeTemplate<Family>::COOKIE_OFFSET, cookie)) {
+        if (cookie != codec_.cookie(tag, generation)) {
+            ++receiver_stats_.replies_rejected;
+            return false;
+        }
+    } else if (icmp_status == IcmpRespStatus::EchoReply) {
+        ++receiver_stats_.replies_rejected;
+        return false;
+    }
+
+    int ttl = options_.start_ttl + ttl_ind;
+
+    if (icmp_status != IcmpRespStatus::TimeExceeded) {
+        // Received probe is useless, we reached destination with smaller ttl
+        if (ttl_done_[dest_ind].load(std::memory_order_relaxed) < ttl) {
+            return false;
+        } else {
+            ttl_done_[dest_ind].store(ttl, std::memory_order_relaxed);
+        }
+    }
+
+    reply.dest_ind = dest_ind;
+    reply.generation = generation;
+    reply.ttl = ttl;
+    reply.probe_ind = probe_ind;
+    reply.icmp_status = icmp_status;
+    reply.offender = from;
+    reply.recv_time = recv_time;
+    reply.hop_limit = hop_limit;
+
+    return true;
+}
+
+/*
+ * Method rebuilds a reply to a stateless probe from the packet alone: the ttl and the
+ * send time from the tag, the destination from the quoted IP header. Runs in the
+ * receiving thread.
+ */
+template <typename Family>
+bool FamilyProber<Family>::parse_stateless_(const IcmpReplyView<Family> &view,
+                                            const Address &from,
+                                            std::chrono::steady_clock::time_point recv_time,
+                                            ReplyRecord &reply)
+{
+    IcmpRespStatus icmp_status = view.get_resp_status();
+
+    u_int32_t tag = view.get_tag();
+    int ttl = tag >> STATELESS_TTL_SHIFT;
+
+    if (ttl < options_.start_ttl || ttl > options_.max_ttl) {
+        ++receiver_stats_.replies_rejected;
+        return false;
+    }
+
+    if (icmp_status == IcmpRespStatus::EchoReply) {
+        reply.target = from;
+    } else {
+        reply.target = Family::make_address(view.get_quoted_ip_ptr() + Family::dst_addr_offset);
+    }
+
+    // Same rule as for the stateful probes, a cookie that is there has to match
+    u_int32_t target = fnv1a(Family::addr_ptr(reply.target.get_sockaddr_ptr()), Family::addr_len);
+    u_int32_t cookie;
+
+    if (view.read_echo32(ProbeTemplate<Family>::COOKIE_OFFSET, cookie)) {
+        if (cookie != codec_.cookie(tag, target)) {
+            ++receiver_stats_.replies_rejected;
+            return false;
+        }
+    } else if (icmp_status == IcmpRespStatus::EchoReply) {
+        ++receiver_stats_.replies_rejected;
+        return false;
+    }
+
+    reply.ttl = ttl;
+    reply.icmp_status = icmp_status;
+    reply.offender = from;
+    reply.recv_time = recv_time;
+    reply.rtt_us = (micros_(recv_time) - tag) & STATELESS_TIME_MASK;
+
+    return true;
+}
+
+template class FamilyProber<Inet4>;
+template class FamilyProber<Inet6>;
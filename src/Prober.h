@@ -0,0 +1,403 @@
+#ifndef PROBER_H
+#define PROBER_H
+
+#include "multi_traceroute.h"
+#include "DestFeed.h"
+#include "SpscRing.h"
+#include "ProbeCodec.h"
+#include "ProbeTable.h"
+#include "KeyedPermutation.h"
+#include "net/PacketIo.h"
+#include "net/EventLoop.h"
+#include "net/ProbeTemplate.h"
+#include "net/FamilyTraits.h"
+#include "net/ReverseResolver.h"
+#include "net/DistanceCache.h"
+#include "net/IcmpReplyView.h"
+#include "net/enums.h"
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <utility>
+#include <string>
+#include <unordered_map>
+
+// Maximum number of probes sent by a single Prober::send (one sendmmsg call)
+constexpr size_t SEND_BATCH_MAX = 64;
+
+/* Silent hops before the next forward probe of a destination, see FamilyProber */
+enum class GapState {
+    // Some of the last gap_limit hops answered (or there are not that many yet)
+    Open,
+    // None answered, but some were sent less than waittime ago
+    Pending,
+    Reached,
+};
+
+/* Last hop in the ttl range of a destination that was not reached yet, see FamilyProber */
+enum class RangeState {
+    // A probe of it was forwarded, the destination is farther than estimated
+    Exceeded,
+    // None answered, but some were sent less than the timeout ago
+    Pending,
+    // Silent, the destination is not probed past it
+    Ended,
+};
+
+/* A reply matched to a probe, passed from the receiving thread to the prober */
+struct ReplyRecord {
+    size_t dest_ind;
+
+    // Generation of dest_ind the reply belongs to
+    u_int32_t generation;
+    int ttl;
+    int probe_ind;
+    IcmpRespStatus icmp_status;
+    Address offender;
+    std::chrono::steady_clock::time_point recv_time;
+
+    // Stateless probing only, the destination and the round trip time taken from the reply
+    Address target;
+    u_int32_t rtt_us;
+
+    // TTL (hop limit) the reply arrived with, -1 if unknown
+    int hop_limit;
+};
+
+/*
+ * Interface of a prober as seen by the event loop in multi_traceroute. The loop calls
+ * it once per batch of probes or replies, the per-packet work is done by FamilyProber.
+ */
+class Prober {
+public:
+    /*
+     * Method takes destinations resolved since the last call. The socket is opened
+     * and the receiving thread started when the first destination arrives.
+     */
+    virtual void fetch_dests() = 0;
+
+    /*
+     * True if the prober takes destinations a portion at a time (shards) and has room for
+     * more, which fetch_dests takes then without the feed signalling anything.
+     */
+    virtual bool wants_dests() const = 0;
+
+    /* Descriptor which becomes readable when there are replies to apply */
+    virtual int get_fd() const = 0;
+
+    /* True if there is a probe waiting to be sent */
+    virtual bool has_work() const = 0;
+
+    /*
+     * Time a probe may be sent again if every destination waits for its silent hops to
+     * time out (gap limit), time_point::max() otherwise.
+     */
+    virtual std::chrono::steady_clock::time_point get_held_until() const = 0;
+
+    /* True if the feed is closed and every probe has been sent */
+    virtual bool is_done() const = 0;
+
+    /* Method sends at most max (up to SEND_BATCH_MAX) probes with a single sendmmsg, returns the number sent */
+    virtual size_t send(size_t max) = 0;
+
+    /*
+     * Method applies replies published by the receiving thread to the probe table.
+     * An exception thrown in the receiving thread is rethrown here.
+     */
+    virtual void apply_replies() = 0;
+
+    /* Method stops the receiving thread and applies the replies it has left */
+    virtual void finish() = 0;
+
+    /*
+     * Method retires destinations finished by now - all of their probes are answered or
+     * timed out. With a sink (TraceOptions::stream) they are handed to it and their probes
+     * released. Returns the time the next destination finishes at or time_point::max() if
+     * none is waiting for replies; the run is over once every prober is done and has
+     * nothing to wait for.
+     */
+    virtual std::chrono::steady_clock::time_point retire(std::chrono::steady_clock::time_point now,
+                                                         RouteSink *sink) = 0;
+
+    virtual ~Prober() { }
+};
+
+/*
+ * Class FamilyProber traceroutes destinations of a single address family (Inet4 or
+ * Inet6), so packet building and parsing compile without family branches. It owns
+ * one raw socket used both for sending and receiving. Sending never blocks - it is
+ * driven by the event loop in multi_traceroute, which decides when it may send.
+ *
+ * Receiving runs in a separate thread which drains the socket, parses the replies and
+ * publishes them through a SpscRing. Probe state (the probe table, next_probe_, ...) has
+ * a single owner, the event loop thread, which applies the published replies. The only
+ * state shared otherwise is ttl_done_, see below.
+ *
+ * Destinations are probed in passes; every pass sends the next probe to each destination
+ * that is not finished yet. Destinations resolved later join the current pass, so
+ * sending does not wait for the slowest DNS lookup. A prober which is one of several
+ * shards keeps only SHARD_INTAKE destinations in its passes, the rest wait in the feed,
+ * where another shard which runs out of destinations may take them (set_siblings).
+ *
+ * Every destination is probed forward from its first_ttl_ up to max_ttl and then backward
+ * down to start_ttl. Without doubletree or descending order first_ttl_ is start_ttl, so
+ * there are no backward probes.
+ *
+ * With hop_distance the first probe of a destination goes out with max_ttl alone, the
+ * others wait until it is answered or times out. The TTL of an Echo Reply gives the
+ * distance of the destination, its forward probes stop a few hops past it (last_ttl_) and
+ * with descending order they also start at it. The reply is not recorded, its slot is
+ * probed again if it is in the range. A DistanceCache gives the distance of destinations
+ * in networks traced by earlier runs without the distance probe, and it is told the
+ * distance of every retired destination.
+ *
+ * An estimate may be too short. If the last hop in the range forwards a probe (Time
+ * Exceeded) before the destination is reached, the range is extended to max_ttl; while
+ * that hop has not answered, the destination is held like with the gap limit below.
+ *
+ * With doubletree (TraceOptions::doubletree_hop) the first ttl is the doubletree hop
+ * unless the distance says otherwise, and probing uses two stop sets:
+ *   - local_stop_  - interfaces seen by any route; backward probing stops at a known one,
+ *                    the hops closer to us were already seen
+ *   - global_stop_ - pairs of an interface and the network of a destination it was seen
+ *                    on the way to; forward probing stops when the route joins a known one
+ * Stop sets are updated as replies are applied, so probes already sent by then are not
+ * taken back. Probes left out are marked as skipped in the probe table.
+ *
+ * A destination with no probe left to send is finishing until all of its probes up to
+ * the ttl it was reached at are answered or its timeout since the last probe passes.
+ * The timeout is waittime, or with min_waittime estimated from the destination's round
+ * trip times like TCP's retransmission timeout (RFC 6298).
+ *
+ * With a gap limit, forward probing of a destination ends when the last gap_limit hops
+ * got no reply within the timeout, the rest of its forward probes are marked as truncated.
+ * While those hops are unanswered but not timed out yet, the destination is held - it
+ * stays in the pass but sends nothing. If a whole pass holds every destination, the
+ * prober has no work until a reply arrives or held_until_.
+ *
+ * In stateless mode (TraceOptions::stateless) there are no passes and no probe table.
+ * Once all destinations are known, probe k of dests * ttls * probes is the k-th element
+ * of a KeyedPermutation, so consecutive probes go to unrelated destinations and hops.
+ * The tag carries the ttl in the upper 8 bits and the send time in microseconds
+ * (mod 2^24) in the rest, the cookie is keyed by the destination address. The receiving
+ * thread takes the destination from the IP header quoted in an error (or the source of
+ * an Echo Reply) and rebuilds the whole reply from the packet alone.
+ */
+template <typename Family>
+class FamilyProber : public Prober {
+public:
+    FamilyProber(DestFeed &feed,
+                 std::vector<DestInfo> &dest,
+                 ProbeTable &probes,
+                 ReverseResolver *reverse,
+                 DistanceCache *distances,
+                 SendStats &send_stats,
+                 RecvStats &recv_stats,
+                 const ProbeCodec &codec,
+                 const TraceOptions &options);
+
+    ~FamilyProber();
+
+    /*
+     * Method makes the prober one of several shards of its family: it takes destinations
+     * from its feed only as its passes need them, and once the feed is closed and empty it
+     * takes over destinations still waiting in the feeds of the other shards.
+     */
+    void set_siblings(const std::vector<DestFeed *> &siblings);
+
+    void fetch_dests() override;
+    bool wants_dests() const override;
+    int get_fd() const override;
+    bool has_work() const override;
+    std::chrono::steady_clock::time_point get_held_until() const override;
+    bool is_done() const override;
+    size_t send(size_t max) override;
+    void apply_replies() override;
+    void finish() override;
+    std::chrono::steady_clock::time_point retire(std::chrono::steady_clock::time_point now,
+                                                 RouteSink *sink) override;
+
+private:
+    DestFeed &feed_;
+    bool feed_open_ = true;
+
+    // Shards only: feeds of the other shards, whether the own feed had more than was taken
+    // and whether theirs may still have something left
+    std::vector<DestFeed *> siblings_;
+    size_t next_sibling_ = 0;
+    bool feed_backlog_ = false;
+    bool can_steal_ = true;
+
+    std::vector<DestInfo> &dest_;
+    ProbeTable &probes_;
+    ReverseResolver *reverse_;
+    DistanceCache *distances_;
+    SendStats &send_stats_;
+    RecvStats &recv_stats_;
+
+    // Maps probes to ICMP ID, SEQ and payload cookie and back
+    ProbeCodec codec_;
+    TraceOptions options_;
+    int ttls_;
+
+    std::unique_ptr<PacketIo> io_;
+    ProbeTemplate<Family> probe_template_;
+
+    /*
+     * k-th element is the smallest ttl of packet which reached k-th destination. It is
+     * sized for every destination index up front and written only by the receiving thread,
+     * which drops replies from beyond it. The sender reads it to skip probes past the
+     * destination; a stale value costs at most a useless probe and no other data is
+     * published through it, so relaxed ordering is enough. The sender only resets it
+     * when it gives the index to a new destination.
+     */
+    std::vector<std::atomic<int>> ttl_done_;
+
+    /*
+     * Generation of every destination index, bumped by the sender when the index of a
+     * finished destination is reused (streaming only). It is part of the probe cookie, so
+     * the receiving thread tells late replies to the previous destination from the new
+     * ones; the bump is released after ttl_done_ is reset.
+     */
+    std::vector<std::atomic<u_int32_t>> generation_;
+
+    // Indices of retired destinations, reused oldest first to give late replies the most time
+    std::deque<size_t> free_dests_;
+
+    /*
+     * next_probe_ - position of the next probe for every destination in the order the
+     *               probes are sent, see probe_ttl_()
+     * active_     - destinations in the current pass; those before pass_pos_ are already
+     *               handled and the unfinished ones were moved to the first still_active_ slots
+     */
+    std::vector<int> next_probe_;
+    std::vector<size_t> active_;
+
+    // Destinations taken from the feed by the last fetch_dests
+    std::vector<DestInfo> fetched_;
+    size_t pass_pos_ = 0;
+    size_t still_active_ = 0;
+
+    // Gap limit: destinations held in the current pass and the earliest time one of them
+    // is due, time the prober may send again if the last pass held them all
+    size_t pass_held_ = 0;
+    std::chrono::steady_clock::time_point pass_due_ = std::chrono::steady_clock::time_point::max();
+    std::chrono::steady_clock::time_point held_until_ = std::chrono::steady_clock::time_point::min();
+
+    /*
+     * Destinations with no probe left to send ordered by the time they finish at, due_ is
+     * that time for every destination (time_point::max() if not finishing). Entries whose
+     * time does not match due_ are stale, the destination finished early.
+     */
+    typedef std::pair<std::chrono::steady_clock::time_point, size_t> FinishEntry;
+    std::priority_queue<FinishEntry, std::vector<FinishEntry>, std::greater<FinishEntry>> finishing_;
+    std::vector<std::chrono::steady_clock::time_point> due_;
+
+    // Destinations whose last probe is in the batch being built
+    std::vector<size_t> last_sent_;
+
+    // Smoothed round trip time and its variation of every destination in microseconds
+    std::vector<u_int32_t> srtt_;
+    std::vector<u_int32_t> rttvar_;
+
+    /*
+     * Ttl range of every destination, forward probes go from first_ttl_ up to last_ttl_
+     * (start_first_ttl_ and max_ttl unless the hop distance says otherwise), and the state
+     * of its distance probe
+     */
+    int start_first_ttl_;
+    std::vector<u_int8_t> first_ttl_;
+    std::vector<u_int8_t> last_ttl_;
+    std::vector<u_int8_t> distance_;
+
+    // Doubletree: stop bits of every destination and the stop sets keyed by raw address
+    // bytes, each entry holds input_ind of the destination which added it
+    std::vector<u_int8_t> stopped_;
+    std::unordered_map<std::string, size_t> local_stop_;
+    std::unordered_map<std::string, size_t> global_stop_;
+
+    // Stateless mode: order of the probes, the next one to send and replies not yet handed out
+    std::unique_ptr<KeyedPermutation> perm_;
+    u_int64_t perm_pos_ = 0;
+    std::chrono::steady_clock::time_point epoch_;
+    std::vector<DecodedReply> decoded_;
+
+    // Replies to stateless probes are waited for until waittime after the last one
+    std::chrono::steady_clock::time_point stateless_due_;
+
+    // Probes of the batch being built
+    size_t packet_len_;
+    std::vector<char> batch_buf_;
+    std::vector<OutPacket> batch_;
+    std::vector<size_t> batch_probes_;
+
+    // Receiving thread and what it shares with the event loop thread
+    std::thread receiver_;
+    SpscRing<ReplyRecord> replies_;
+    Notifier replies_ready_;
+    Notifier stop_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> receiver_failed_{false};
+    std::exception_ptr receiver_error_;
+
+    // Used by the receiving thread only, merged into recv_stats_ by finish()
+    RecvBatch recv_batch_;
+    RecvStats receiver_stats_;
+
+    void open_io_();
+    size_t steal_(size_t max);
+    void add_probe_(size_t dest_ind, int ttl, int p);
+    void flush_batch_();
+
+    /* Ttl of the probe at position pos of a destination's sending order */
+    int probe_ttl_(size_t dest_ind, int pos) const {
+        int level = pos / options_.probes;
+        int first_ttl = first_ttl_[dest_ind];
+        int forward = options_.max_ttl - first_ttl + 1;
+
+        return (level < forward) ? first_ttl + level : first_ttl - 1 - (level - forward);
+    }
+
+    /* Position of a destination's first backward probe */
+    int forward_end_(size_t dest_ind) const {
+        return (options_.max_ttl - first_ttl_[dest_ind] + 1) * options_.probes;
+    }
+
+    std::chrono::microseconds timeout_(size_t dest_ind) const;
+    void update_rtt_(size_t dest_ind, u_int32_t rtt_us);
+    bool all_answered_(size_t dest_ind) const;
+    void finish_at_(size_t dest_ind, std::chrono::steady_clock::time_point time);
+
+    void skip_probes_(size_t dest_ind, int end);
+    GapState gap_state_(size_t dest_ind, int ttl, std::chrono::steady_clock::time_point now,
+                        std::chrono::steady_clock::time_point &due) const;
+    void skip_stopped_(size_t dest_ind);
+    void update_stop_sets_(const ReplyRecord &reply);
+    void set_distance_(const ReplyRecord &reply);
+    void set_range_(size_t dest_ind, int distance);
+    RangeState range_state_(size_t dest_ind, std::chrono::steady_clock::time_point now,
+                            std::chrono::steady_clock::time_point &due) const;
+    void record_distance_(size_t dest_ind);
+    size_t send_stateless_(size_t max);
+
+    u_int32_t micros_(std::chrono::steady_clock::time_point time) const {
+        return static_cast<u_int32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(time - epoch_).count());
+    }
+
+    void receive_loop_();
+    void receive_batches_();
+    bool parse_reply_(const char *recv_buf, int n_bytes, const Address &from, int hop_limit,
+                      std::chrono::steady_clock::time_point recv_time, ReplyRecord &reply);
+    bool parse_stateless_(const IcmpReplyView<Family> &view, const Address &from,
+                          std::chrono::steady_clock::time_point recv_time, ReplyRecord &reply);
+};
+
+#endif // PROBER_H
@@ -0,0 +1,42 @@
+#include "RatePacer.h"
+
+#include <chrono>
+#include <algorithm>
+
+RatePacer::RatePacer(double rate, int burst) :
+    rate_(rate), burst_(std::max(burst, 1)), tokens_(std::max(burst, 1)) { }
+
+void RatePacer::refill_(clock::time_point now) {
+    if (started_) {
+        double elapsed_us = std::chrono::duration<double, std::micro>(now - last_refill_).count();
+        tokens_ = std::min(burst_, tokens_ + elapsed_us * rate_ / 1e6);
+    }
+
+    last_refill_ = now;
+    started_ = true;
+}
+
+size_t RatePacer::available(size_t max) {
+    if (rate_ <= 0) {
+        return max;
+    }
+
+    refill_(clock::now());
+
+    return std::min(max, static_cast<size_t>(tokens_));
+}
+
+void RatePacer::consume(size_t count) {
+    if (rate_ > 0) {
+        tokens_ -= count;
+    }
+}
+
+RatePacer::clock::time_point RatePacer::next_token_time() const {
+    if (rate_ <= 0 || tokens_ >= 1) {
+        return last_refill_;
+    }
+
+    double wait_us = (1 - tokens_) * 1e6 / rate_;
+    return last_refill_ + std::chrono::microseconds(static_cast<long long>(wait_us) + 1);
+}
@@ -0,0 +1,44 @@
+#ifndef RATE_PACER_H
+#define RATE_PACER_H
+
+#include <chrono>
+#include <cstddef>
+
+/*
+ * Class RatePacer is a token bucket limiting sending to `rate` packets per second.
+ * The bucket holds at most `burst` tokens, so at most `burst` packets may leave
+ * back-to-back after the sender was late. Time is measured in microseconds.
+ *
+ * The pacer never blocks, the caller waits (e.g. on a timer) until next_token_time()
+ * when the bucket is empty. Tokens are computed from the elapsed time, so a late
+ * wakeup is paid back by the following packets and the average rate stays exact
+ * without a wakeup per packet.
+ */
+class RatePacer {
+public:
+    /* Rate 0 means no limit */
+    RatePacer(double rate, int burst);
+
+    /* Number of packets (at most max) that may be sent right now */
+    size_t available(size_t max);
+
+    /* Take tokens for count sent packets */
+    void consume(size_t count);
+
+    /* Time when the next token will be available */
+    std::chrono::steady_clock::time_point next_token_time() const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    double rate_;
+    double burst_;
+    double tokens_;
+
+    clock::time_point last_refill_;
+    bool started_ = false;
+
+    void refill_(clock::time_point now);
+};
+
+#endif // RATE_PACER_H
@@ -0,0 +1,91 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/*
+ * Class SpscRing is a bounded lock-free queue for exactly one producer thread and
+ * one consumer thread.
+ *
+ * The producer fills a slot and then publishes it by a release store of tail_, the
+ * consumer acquires tail_ before reading the slot. In the other direction the consumer
+ * releases a slot by storing head_ and the producer acquires head_ before overwriting
+ * it. Each side keeps a cached copy of the other side's index and reloads it only when
+ * the ring looks full (empty), so most operations touch no shared cache line but the
+ * slot itself.
+ */
+template <typename T>
+class SpscRing {
+public:
+    /* Capacity is rounded up to a power of two */
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+
+        slots_.resize(size);
+        mask_ = size - 1;
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /* Producer only. Returns false if the ring is full. */
+    bool try_push(const T &item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - head_cache_ == slots_.size()) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+
+            if (tail - head_cache_ == slots_.size()) {
+                return false;
+            }
+        }
+
+        slots_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /* Consumer only. Returns false if the ring is empty. */
+    bool try_pop(T &item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+
+        item = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // Written by the consumer
+    char pad0_[CACHE_LINE];
+    std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+
+    // Written by the producer
+    char pad1_[CACHE_LINE];
+    std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+
+    char pad2_[CACHE_LINE];
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,184 @@
+#include "TraceSession.h"
+#include "multi_traceroute.h"
+#include "ProbeTable.h"
+#include "net/HostSource.h"
+#include "net/EventLoop.h"
+#include "net/enums.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <utility>
+#include <exception>
+
+constexpr int TraceSession::SESSION_WINDOW;
+
+/* True if a reply with status comes from the destination (or instead of it), as the routes are printed */
+static bool reaches_dest(IcmpRespStatus status) {
+    switch (status) {
+        case IcmpRespStatus::EchoReply:
+        case IcmpRespStatus::HostUnreachable:
+        case IcmpRespStatus::NetworkUnreachable:
+        case IcmpRespStatus::ProtocolUnreachable:
+        case IcmpRespStatus::AdminProhibited:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Class QueueSink turns the streamed routes into events of the session. Hops are copied
+ * out of the probe table, whose row is released as soon as route_done returns.
+ */
+class TraceSession::QueueSink : public RouteSink {
+public:
+    QueueSink(TraceSession &session, int start_ttl) : session_(session), start_ttl_(start_ttl) { }
+
+    void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) override {
+        TraceEvent event;
+        event.type = TraceEventType::RouteDone;
+        event.dest = dest;
+
+        size_t replied = 0;
+
+        // Replies from beyond the first hop which reached the destination are left out
+        for (int ttl = 0; ttl < probes.get_ttls() && !event.reached; ++ttl) {
+            HopResult hop;
+            hop.ttl = start_ttl_ + ttl;
+            hop.probes.resize(probes.get_probes());
+
+            for (int p = 0; p < probes.get_probes(); ++p) {
+                size_t slot = probes.slot(dest_ind, ttl, p);
+
+                if (!probes.did_arrive(slot)) {
+                    continue;
+                }
+
+                ProbeReply &reply = hop.probes[p];
+                reply.arrived = true;
+                reply.offender = probes.get_offender(slot);
+                reply.status = probes.get_status(slot);
+                reply.rtt_us = probes.get_rtt_us(slot);
+
+                replied = ttl + 1;
+                event.reached = event.reached || reaches_dest(reply.status);
+            }
+
+            event.hops.push_back(std::move(hop));
+        }
+
+        event.hops.resize(replied);
+        session_.push_event_(std::move(event));
+    }
+
+    void route_failed(const DestInfo &dest) override {
+        TraceEvent event;
+        event.type = TraceEventType::RouteFailed;
+        event.dest = dest;
+
+        session_.push_event_(std::move(event));
+    }
+
+private:
+    TraceSession &session_;
+    int start_ttl_;
+};
+
+TraceSession::TraceSession(TraceOptions options) : options_(options) {
+    queue_sink_.reset(new QueueSink(*this, options_.start_ttl));
+    start_(*queue_sink_);
+}
+
+TraceSession::TraceSession(TraceOptions options, RouteSink &sink) : options_(options) {
+    start_(sink);
+}
+
+TraceSession::~TraceSession() {
+    cancel();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void TraceSession::start_(RouteSink &sink) {
+    // Hosts come on the go, so routes have to be forgotten as they finish
+    options_.stream = true;
+
+    if (options_.window == 0) {
+        options_.window = SESSION_WINDOW;
+    }
+
+    thread_ = std::thread([this, &sink]() {
+        try {
+            result_ = multi_traceroute(hosts_, options_, &sink, &cancel_);
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ended_ = true;
+        events_ready_.notify();
+    });
+}
+
+void TraceSession::add(const std::string &host) {
+    hosts_.push(host);
+}
+
+void TraceSession::add(const std::vector<std::string> &hosts) {
+    for (const std::string &host : hosts) {
+        hosts_.push(host);
+    }
+}
+
+void TraceSession::close() {
+    hosts_.close();
+}
+
+void TraceSession::cancel() {
+    // Probing stops first, so that no new host is taken meanwhile
+    cancel_.notify();
+    hosts_.close();
+}
+
+int TraceSession::get_fd() const {
+    return events_ready_.get_fd();
+}
+
+void TraceSession::push_event_(TraceEvent &&event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(std::move(event));
+    events_ready_.notify();
+}
+
+bool TraceSession::poll(std::vector<TraceEvent> &events) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Notified under the lock, so nothing comes between consuming and taking the events
+    events_ready_.consume();
+
+    bool had_events = !events_.empty();
+
+    for (TraceEvent &event : events_) {
+        events.push_back(std::move(event));
+    }
+
+    events_.clear();
+
+    return !ended_ || had_events;
+}
+
+TraceResult TraceSession::wait() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+
+    return result_;
+}
@@ -0,0 +1,127 @@
+#ifndef TRACE_SESSION_H
+#define TRACE_SESSION_H
+
+#include "multi_traceroute.h"
+#include "net/Address.h"
+#include "net/HostSource.h"
+#include "net/EventLoop.h"
+#include "net/enums.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <exception>
+#include <cstdint>
+
+/* A probe of a finished route, offender and the rest are valid only if it arrived */
+struct ProbeReply {
+    bool arrived = false;
+    Address offender;
+    IcmpRespStatus status = IcmpRespStatus::Unknown;
+    u_int32_t rtt_us = 0;
+};
+
+/* Probes of one ttl of a finished route */
+struct HopResult {
+    int ttl;
+    std::vector<ProbeReply> probes;
+};
+
+enum class TraceEventType {
+    RouteDone,
+    RouteFailed,
+};
+
+/*
+ * Structure holds what a TraceSession reports: a finished route, its hops from start_ttl
+ * up to the last one which replied (or the one which reached dest), or a host whose
+ * lookup failed.
+ */
+struct TraceEvent {
+    TraceEventType type;
+    DestInfo dest;
+
+    std::vector<HopResult> hops;
+    bool reached = false;
+};
+
+/*
+ * Class TraceSession traces hosts in the background for an application which embeds the
+ * library, so the application's own loop never blocks on probing. Hosts are added one
+ * at a time while the session runs, every host is traced as soon as it is resolved.
+ *
+ * Finished routes are handed out one by one and forgotten (the session always streams):
+ * either to a RouteSink, whose methods are called from the session's thread, or queued
+ * as TraceEvents. get_fd becomes readable when there are events to poll, so it can be
+ * watched with the application's other descriptors.
+ *
+ * At most options.window hosts are traced at once (SESSION_WINDOW if it is 0), hosts
+ * added beyond that wait for others to finish. Stateless probing needs every host up
+ * front, so a session cannot do it.
+ */
+class TraceSession {
+public:
+    static constexpr int SESSION_WINDOW = 1024;
+
+    /* Routes are queued as events */
+    explicit TraceSession(TraceOptions options);
+
+    /* Routes are handed to sink, which has to outlive the session */
+    TraceSession(TraceOptions options, RouteSink &sink);
+
+    TraceSession(const TraceSession &) = delete;
+    TraceSession &operator=(const TraceSession &) = delete;
+
+    /* Cancels the session if it is still running */
+    ~TraceSession();
+
+    /* Methods can be called from any thread, hosts added after close or cancel are ignored */
+    void add(const std::string &host);
+    void add(const std::vector<std::string> &hosts);
+
+    /* Method tells the session no more hosts are coming, it ends once they are all traced */
+    void close();
+
+    /* Method ends the session early, routes not finished yet are not reported */
+    void cancel();
+
+    /* Descriptor which is readable while there are events to poll or once the session ended */
+    int get_fd() const;
+
+    /*
+     * Method moves the events queued so far to the end of events, without blocking.
+     * Returns false once the session has ended and its last events were taken.
+     */
+    bool poll(std::vector<TraceEvent> &events);
+
+    /*
+     * Method blocks until the session ends and returns its statistics (the result holds
+     * no routes). Rethrows the exception which ended the session, if any.
+     */
+    TraceResult wait();
+
+private:
+    class QueueSink;
+
+    TraceOptions options_;
+    HostSource hosts_;
+    Notifier cancel_;
+
+    // Events of a session without a sink of its own
+    std::unique_ptr<QueueSink> queue_sink_;
+    Notifier events_ready_;
+    std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+    bool ended_ = false;
+
+    TraceResult result_;
+    std::exception_ptr error_;
+    std::thread thread_;
+
+    void start_(RouteSink &sink);
+    void push_event_(TraceEvent &&event);
+};
+
+#endif // TRACE_SESSION_H
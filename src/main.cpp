@@ -1,5 +1,6 @@
 #include "multi_traceroute.h"
 #include "net/enums.h"
+#include "net/utility.h"
 
 #include <vector>
 #include <string>
@@ -8,120 +9,167 @@
 #include <chrono>
 #include <cstdlib>
 #include <unistd.h>
+#include <getopt.h>
 #include <exception>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <map>
+#include <thread>
+#include <system_error>
+#include <cerrno>
 
 using std::vector;
 
-constexpr AddressFamily DEF_AF_IN_UNKNOWN = AddressFamily::Inet;
-constexpr int DEF_PROBES = 3;
-constexpr int DEF_SENDWAIT = 10;
-constexpr int DEF_WAITTIME = 500;
-constexpr int DEF_START_TTL = 1;
-constexpr int DEF_MAX_TTL = 30;
-constexpr bool DEF_MAP_IP_TO_HOST = true;
-
-
-void print_routes(vector<vector<vector<ProbeInfo>>> &probes_info, vector<DestInfo> &dest, TraceOptions options) {
-    // TTLs of last packet that sucessfully returned for each destination
-    vector<int> last_arrived(dest.size(), options.start_ttl - 1);
-
-    for (size_t d = 0; d < probes_info.size(); ++d) {
-        for (size_t ttl = 0; ttl < probes_info[d].size(); ++ttl) {
-            for (const auto &probe : probes_info[d][ttl]) {
-                if (probe.did_arrive) {
-                    last_arrived[d] = ttl + options.start_ttl;
-                }
+// First ttl of --doubletree without a value
+constexpr int DEF_DOUBLETREE_START = 5;
+
+/* Function prints the route to dest, whose probes are in probes at probes.slot(d, ...) */
+void print_route(std::ostream &out, const DestInfo &dest, const ProbeTable &probes, size_t d,
+                 const TraceOptions &options)
+{
+    // TTL of last packet that sucessfully returned, replies from beyond the first hop
+    // which reached the destination (descending probes come from above) are not shown
+    int last_arrived = options.start_ttl - 1;
+    bool reached = false;
+
+    for (int ttl = 0; ttl < probes.get_ttls() && !reached; ++ttl) {
+        for (int p = 0; p < probes.get_probes(); ++p) {
+            size_t slot = probes.slot(d, ttl, p);
+
+            if (probes.did_arrive(slot)) {
+                last_arrived = ttl + options.start_ttl;
+                reached = reached || probes.get_status(slot) != IcmpRespStatus::TimeExceeded;
             }
         }
     }
 
-    for (size_t d = 0; d < probes_info.size(); ++d) {
-        std::cout << "traceroute to " << dest[d].dest_str << " (" << dest[d].address.get_ip_str()
-                  << "), " << options.max_ttl << " hops max\n";
-        bool dest_reached = false;
+    out << "traceroute to " << dest.dest_str << " (" << dest.address.get_ip_str()
+        << "), " << options.max_ttl << " hops max\n";
+    bool dest_reached = false;
 
-        for (size_t ttl = 0; ttl + options.start_ttl <= last_arrived[d]; ++ttl) {
-            std::cout << std::setw(2) << ttl + options.start_ttl;
+    for (size_t ttl = 0; ttl + options.start_ttl <= last_arrived; ++ttl) {
+        out << std::setw(2) << ttl + options.start_ttl;
 
-            std::string last_ip = "";
+        std::string last_ip = "";
 
-            for (size_t p = 0; p < probes_info[d][ttl].size(); ++p) {
-                const ProbeInfo &probe = probes_info[d][ttl][p];
+        for (int p = 0; p < probes.get_probes(); ++p) {
+            size_t slot = probes.slot(d, ttl, p);
 
-                if (!probe.did_arrive) {
-                    std::cout << "  *";
-                    continue;
-                }
+            // Hop is known from another route (doubletree)
+            if (probes.was_skipped(slot)) {
+                out << "  -";
+                continue;
+            }
 
-                std::string ip = probe.offender.get_ip_str();
-                int rtt = std::chrono::duration_cast<std::chrono::microseconds>(probe.recv_time - probe.send_time).count();
+            if (!probes.did_arrive(slot)) {
+                out << "  *";
+                continue;
+            }
 
-                if (ip != last_ip) {
-                    if (p != 0) {
-                        std::cout << "\n  ";
-                    }
+            const Address &offender = probes.get_offender(slot);
+            std::string ip = offender.get_ip_str();
+            u_int32_t rtt = probes.get_rtt_us(slot);
 
-                    if (options.map_ip_to_host) {
-                        std::cout << "  " << probe.offender.get_hostname() << " (" << ip << ")";
-                    } else {
-                        std::cout << "  " << ip;
-                    }
+            if (ip != last_ip) {
+                if (p != 0) {
+                    out << "\n  ";
                 }
 
-                std::cout << "  " << std::fixed << std::setprecision(3) << static_cast<double>(rtt) / 1000 << " ms";
-
-                switch (probe.icmp_status) {
-                    case IcmpRespStatus::HostUnreachable:
-                        std::cout << "  !H";
-                        dest_reached = true;
-                        break;
-
-                    case IcmpRespStatus::NetworkUnreachable:
-                        std::cout << "  !N";
-                        dest_reached = true;
-                        break;
-
-                    case IcmpRespStatus::ProtocolUnreachable:
-                        std::cout << "  !P";
-                        dest_reached = true;
-                        break;
-
-                    case IcmpRespStatus::AdminProhibited:
-                        std::cout << "  !X";
-                        dest_reached = true;
-                        break;
-                    case IcmpRespStatus::EchoReply:
-                        dest_reached = true;
-                        break;
-
-                    default: break;
+                if (options.map_ip_to_host) {
+                    out << "  " << offender.get_hostname() << " (" << ip << ")";
+                } else {
+                    out << "  " << ip;
                 }
+            }
 
-                last_ip = ip;
+            out << "  " << std::fixed << std::setprecision(3) << static_cast<double>(rtt) / 1000 << " ms";
+
+            switch (probes.get_status(slot)) {
+                case IcmpRespStatus::HostUnreachable:
+                    out << "  !H";
+                    dest_reached = true;
+                    break;
+
+                case IcmpRespStatus::NetworkUnreachable:
+                    out << "  !N";
+                    dest_reached = true;
+                    break;
+
+                case IcmpRespStatus::ProtocolUnreachable:
+                    out << "  !P";
+                    dest_reached = true;
+                    break;
+
+                case IcmpRespStatus::AdminProhibited:
+                    out << "  !X";
+                    dest_reached = true;
+                    break;
+                case IcmpRespStatus::EchoReply:
+                    dest_reached = true;
+                    break;
+
+                default: break;
             }
 
-            std::cout << std::endl;
+            last_ip = ip;
         }
 
-        /*
-         * Show that the destination wasn't reached
-         * Eg.:
-         *      16  et-17-1.fab1-1-gdc.ne1.yahoo.com (98.138.0.79)  223.473 ms  225.312 ms
-         *      17  po-10.bas1-7-prd.ne1.yahoo.com (98.138.240.6)  225.251 ms  226.105 ms
-         *       .  * * *
-         *       .  * * *
-         *      21  * * *
-         */
-        if (!dest_reached && last_arrived[d] < options.max_ttl) {
-            int dotted = std::min(options.max_ttl - last_arrived[d] - 1, 2);
+        out << std::endl;
+    }
 
-            for (int i = 0; i < dotted; ++i) {
-                std::cout << " .  * * *\n";
-            }
+    /*
+     * Show that the destination wasn't reached
+     * Eg.:
+     *      16  et-17-1.fab1-1-gdc.ne1.yahoo.com (98.138.0.79)  223.473 ms  225.312 ms
+     *      17  po-10.bas1-7-prd.ne1.yahoo.com (98.138.240.6)  225.251 ms  226.105 ms
+     *       .  * * *
+     *       .  * * *
+     *      21  * * *
+     */
+    bool joined_known = false;
+    int last_probed = options.max_ttl;
+    const char *left_out = "";
+
+    for (int ttl = last_arrived - options.start_ttl + 1; ttl < probes.get_ttls(); ++ttl) {
+        size_t slot = probes.slot(d, ttl, 0);
+        joined_known = joined_known || probes.was_skipped(slot);
+
+        if ((probes.was_truncated(slot) || probes.was_out_of_range(slot)) &&
+            ttl + options.start_ttl - 1 < last_probed) {
+            last_probed = ttl + options.start_ttl - 1;
+            left_out = probes.was_truncated(slot) ? "gap limit" : "past hop distance";
+        }
+    }
+
+    // Route joined a known one and the rest was not probed
+    if (!dest_reached && joined_known) {
+        out << " .  - - -  (known route)\n";
+    } else if (!dest_reached && last_arrived == last_probed && last_probed < options.max_ttl) {
+        // Hops right after the last answered one were left out
+        out << " .  (" << left_out << ", not probed further)\n";
+    } else if (!dest_reached && last_arrived < last_probed) {
+        int dotted = std::min(last_probed - last_arrived - 1, 2);
+
+        for (int i = 0; i < dotted; ++i) {
+            out << " .  * * *\n";
+        }
+
+        out << std::setw(2) << last_probed << "  * * *";
 
-            std::cout << std::setw(2) << options.max_ttl << "  * * *\n";
+        // Rest of the route went unprobed after gap_limit silent hops or past the hop distance
+        if (last_probed < options.max_ttl) {
+            out << "  (" << left_out << ", not probed further)";
         }
 
+        out << "\n";
+    }
+}
+
+void print_routes(const ProbeTable &probes, vector<DestInfo> &dest, TraceOptions options) {
+    for (size_t d = 0; d < probes.get_dest_count(); ++d) {
+        print_route(std::cout, dest[d], probes, d, options);
+
         // Don't print newline after last destination
         if (d + 1 < dest.size()) {
             std::cout << std::endl;
@@ -129,10 +177,227 @@ void print_routes(vector<vector<vector<ProbeInfo>>> &probes_info, vector<DestInf
     }
 }
 
+/*
+ * Class StreamPrinter prints routes as multi_traceroute streams them, either right away
+ * (completion order) or in input order. Routes that finish before an earlier destination
+ * wait in a reorder buffer; once it holds more than buffer_size routes, the earliest one
+ * is printed regardless and the destinations before it are printed whenever they finish.
+ */
+class StreamPrinter : public RouteSink {
+public:
+    StreamPrinter(const TraceOptions &options) : options_(options) { }
+
+    void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) override {
+        std::ostringstream route;
+        print_route(route, dest, probes, dest_ind, options_);
+
+        add_(dest.input_ind, route.str());
+    }
+
+    void route_failed(const DestInfo &dest) override {
+        // Nothing is printed, but later destinations must not wait for it
+        add_(dest.input_ind, "");
+    }
+
+    /* Method prints all routes left in the reorder buffer */
+    void finish() {
+        for (auto &held : held_) {
+            print_(held.second);
+        }
+
+        held_.clear();
+    }
+
+private:
+    TraceOptions options_;
+    bool printed_any_ = false;
+
+    // Routes waiting for an earlier destination and the input index printed next
+    std::map<size_t, std::string> held_;
+    size_t next_input_ = 0;
+
+    void add_(size_t input_ind, const std::string &route) {
+        if (!options_.stream_input_order || input_ind < next_input_) {
+            print_(route);
+            return;
+        }
+
+        held_[input_ind] = route;
+
+        // Buffer is full, give up waiting for the missing destinations
+        while (held_.size() > static_cast<size_t>(options_.reorder_buffer)) {
+            next_input_ = held_.begin()->first;
+            release_ready_();
+        }
+
+        release_ready_();
+    }
+
+    void release_ready_() {
+        while (!held_.empty() && held_.begin()->first == next_input_) {
+            print_(held_.begin()->second);
+            held_.erase(held_.begin());
+            ++next_input_;
+        }
+    }
+
+    void print_(const std::string &route) {
+        if (route.empty()) {
+            return;
+        }
+
+        // A newline between destinations
+        if (printed_any_) {
+            std::cout << '\n';
+        }
+
+        std::cout << route << std::flush;
+        printed_any_ = true;
+    }
+};
+
+/*
+ * Class ReplyPrinter prints replies of stateless probing one per line as they arrive:
+ *      10.2.0.2  2  10.2.0.2  0.153 ms
+ * that is the destination, ttl of the probe, offender, round trip time and the mark
+ * of an unreachable destination. Routes are left to whoever reads the output.
+ */
+class ReplyPrinter : public RouteSink {
+public:
+    ReplyPrinter(const TraceOptions &options) : options_(options) { }
+
+    void route_done(const DestInfo &, ProbeTable &, size_t) override { }
+
+    void route_failed(const DestInfo &) override { }
+
+    void reply_decoded(const DecodedReply &reply) override {
+        std::string ip = reply.offender.get_ip_str();
+
+        std::cout << reply.target.get_ip_str() << "  " << reply.ttl << "  ";
+
+        if (options_.map_ip_to_host) {
+            std::cout << reply.offender.get_hostname() << " (" << ip << ")";
+        } else {
+            std::cout << ip;
+        }
+
+        std::cout << "  " << std::fixed << std::setprecision(3) << static_cast<double>(reply.rtt_us) / 1000 << " ms";
+
+        switch (reply.icmp_status) {
+            case IcmpRespStatus::HostUnreachable:
+                std::cout << "  !H";
+                break;
+            case IcmpRespStatus::NetworkUnreachable:
+                std::cout << "  !N";
+                break;
+            case IcmpRespStatus::ProtocolUnreachable:
+                std::cout << "  !P";
+                break;
+            case IcmpRespStatus::AdminProhibited:
+                std::cout << "  !X";
+                break;
+            default: break;
+        }
+
+        std::cout << '\n';
+    }
+
+private:
+    TraceOptions options_;
+};
+
+void print_stats(const TraceResult &res) {
+    const ResolverStats &rs = res.resolver_stats;
+    size_t lookups = rs.resolved + rs.failed;
+    double elapsed_ms = static_cast<double>(rs.elapsed.count()) / 1000;
+
+    std::cerr << std::fixed << std::setprecision(3)
+              << "resolved " << rs.resolved << " of " << lookups << " hosts in " << elapsed_ms << " ms";
+
+    if (lookups > 0) {
+        std::cerr << " (" << (elapsed_ms > 0 ? lookups / elapsed_ms * 1000 : 0) << " hosts/s, latency avg "
+                  << static_cast<double>(rs.total_latency.count()) / lookups / 1000 << " ms, max "
+                  << static_cast<double>(rs.max_latency.count()) / 1000 << " ms)";
+    }
+
+    std::cerr << std::endl;
+
+    const SendStats &ss = res.send_stats;
+    double send_ms = static_cast<double>(ss.duration.count()) / 1000;
+
+    if (ss.probes_skipped > 0) {
+        // Includes forward probes past destinations that would not have been sent anyway
+        std::cerr << "doubletree skipped " << ss.probes_skipped << " probes of hops known from other routes"
+                  << std::endl;
+    }
+
+    if (ss.probes_truncated > 0) {
+        std::cerr << "gap limit left out " << ss.probes_truncated << " probes of silent routes" << std::endl;
+    }
+
+    if (ss.distances_estimated > 0) {
+        std::cerr << "estimated hop distance of " << ss.distances_estimated << " hosts ("
+                  << ss.distances_cached << " cached), left out " << ss.probes_out_of_range
+                  << " probes past it, " << ss.ranges_extended << " hosts were farther" << std::endl;
+    }
+
+    if (ss.dests_stolen > 0) {
+        std::cerr << "shards took over " << ss.dests_stolen << " hosts from each other" << std::endl;
+    }
+
+    std::cerr << "sent " << ss.probes_sent << " probes in " << send_ms << " ms (";
+
+    if (send_ms > 0) {
+        std::cerr << ss.probes_sent / send_ms * 1000 << " pps";
+    } else {
+        std::cerr << "- pps";
+    }
+
+    if (ss.requested_rate > 0) {
+        std::cerr << ", requested " << ss.requested_rate << " pps)" << std::endl;
+    } else {
+        std::cerr << ", unlimited)" << std::endl;
+    }
+
+    std::cerr << "waited " << static_cast<double>(ss.tail.count()) / 1000 << " ms for replies after the last probe"
+              << std::endl;
+
+    const RecvStats &rcs = res.recv_stats;
+
+    std::cerr << "received " << rcs.packets_received << " packets (" << rcs.probes_matched
+              << " replies to probes, " << rcs.replies_rejected << " rejected) in "
+              << rcs.recv_calls << " receive calls";
+
+    if (rcs.recv_calls > 0) {
+        std::cerr << " (" << static_cast<double>(rcs.packets_received) / rcs.recv_calls
+                  << " packets per call, largest batch " << rcs.max_batch << ")";
+    }
+
+    std::cerr << std::endl;
+
+    size_t probe_slots = (res.probes_ip4.get_dest_count() + res.probes_ip6.get_dest_count())
+                       * res.probes_ip4.get_ttls() * res.probes_ip4.get_probes();
+    size_t table_bytes = res.probes_ip4.memory_usage() + res.probes_ip6.memory_usage();
+
+    std::cerr << "probe results take " << table_bytes << " bytes";
+
+    if (probe_slots > 0) {
+        std::cerr << " (" << static_cast<double>(table_bytes) / probe_slots << " bytes per probe)";
+    }
+
+    std::cerr << std::endl;
+}
+
 std::string usage(const char *prog_name) {
     return "usage: " + std::string(prog_name) +
-           " [46nh] [-f start_ttl] [-m max_ttl] [-p nprobes]\n"
-           "          [-z sendwait] [-w waittime] [host...]\n";
+           " [46nsh] [-f start_ttl] [-m max_ttl] [-p nprobes]\n"
+           "          [-z sendwait] [-w waittime] [-j resolvers] [-c cache_file]\n"
+           "          [--rate pps] [--burst count] [--stream[=order]]\n"
+           "          [--reorder-buffer count] [--window count] [--stateless]\n"
+           "          [--doubletree[=hop]] [--gap-limit count] [--min-wait ms]\n"
+           "          [--hop-distance] [--descending] [--distance-cache file]\n"
+           "          [--packet-ring] [--io-uring] [--shards count] [-i file]\n"
+           "          [host...]\n";
 }
 
 std::string help(const char *prog_name) {
@@ -144,20 +409,71 @@ std::string help(const char *prog_name) {
     "\n"
     "Arguments:\n"
     "  hosts                    Hosts to traceroute. If not provided, read\n"
-    "                           them from stdin.\n"
+    "                           them from stdin or file.\n"
     "\n"
     "Options:\n"
     "  -h                       Show this message and exit\n"
     "  -4                       If protocol of a host is unknown use IPv4 (default)\n"
     "  -6                       If protocol of a host is unknown use IPv6\n"
     "  -n                       Do not resolve IP addresses to their domain names\n"
+    "  -s                       Print statistics about the run to stderr\n"
     "  -f start_ttl             Start from the start_ttl hop (default is 1)\n"
     "  -m max_ttl               Set maximum number of hops (default is 30)\n"
     "  -p nprobes               Set the number of probes per each hop (default is 3)\n"
     "  -z sendwait              Wait sendwait milliseconds before sending next probe\n"
     "                           (default is 10)\n"
+    "  --rate pps               Send pps probes per second, overrides sendwait\n"
+    "  --burst count            Allow up to count probes to be sent back-to-back\n"
+    "                           to keep up with the rate (default is 16)\n"
     "  -w waittime              Wait at least waittime milliseconds for the\n"
-    "                           last probe response (deafult is 500)\n";
+    "                           last probe response (deafult is 500)\n"
+    "  -j resolvers             Resolve at most resolvers hostnames concurrently\n"
+    "                           (default is 16)\n"
+    "  -c cache_file            Keep hostnames of seen IPs in cache_file for a day\n"
+    "                           (default is ~/.cache/mulroute/ptr_cache, empty\n"
+    "                           string disables the cache; a set-user-ID\n"
+    "                           mulroute keeps none)\n"
+    "  --stream[=order]         Print every route as soon as it is finished and\n"
+    "                           forget it; order is done (completion order, the\n"
+    "                           default) or input\n"
+    "  --reorder-buffer count   With --stream=input hold back at most count\n"
+    "                           finished routes (default is 1024)\n"
+    "  --window count           Trace at most count hosts at once, read the next\n"
+    "                           host only when another one finishes; implies\n"
+    "                           --stream (default is 0, no limit)\n"
+    "  --stateless              Send the probes of all hosts in a random order\n"
+    "                           and print every reply as it arrives (destination,\n"
+    "                           ttl, offender, time) instead of routes; implies\n"
+    "                           --stream, cannot be used with --window; waittime\n"
+    "                           is at most " + std::to_string(STATELESS_MAX_WAITTIME) + " ms\n"
+    "  --doubletree[=hop]       Probe every host forward from hop (default is 5)\n"
+    "                           and then backward; stop where the route joins\n"
+    "                           hops known from other hosts\n"
+    "  --gap-limit count        Stop probing a host after count hops in a row\n"
+    "                           without a reply (default is 0, never stop)\n"
+    "  --min-wait ms            Wait for replies of a host as long as its round\n"
+    "                           trip times suggest, but at least ms and at most\n"
+    "                           waittime (default is 0, always waittime)\n"
+    "  --hop-distance           Send a single probe to every host first, estimate\n"
+    "                           its distance from the TTL of the reply and do not\n"
+    "                           probe more than 2 hops past it\n"
+    "  --descending             Start probing every host at its estimated distance\n"
+    "                           and go backward afterwards; implies --hop-distance\n"
+    "  --distance-cache file    Keep the hop distance of every traced /24 (IPv4) or\n"
+    "                           /48 (IPv6) network in file for a week and probe\n"
+    "                           hosts of known networks only up to it, past it if\n"
+    "                           the route goes on (default is none)\n"
+    "  --packet-ring            Send and receive probes through packet rings\n"
+    "                           shared with the kernel instead of raw sockets;\n"
+    "                           hosts routed otherwise than the first IPv4 (IPv6)\n"
+    "                           host are probed through raw sockets\n"
+    "  --io-uring               Send and receive probes through io_uring, fall\n"
+    "                           back to raw sockets if the kernel cannot do it\n"
+    "  --shards count           Split the hosts among count shards, each probing\n"
+    "                           with its own sockets on its own core and taking\n"
+    "                           over hosts of the others when it runs out; cannot\n"
+    "                           be used with --stateless (default is 1)\n"
+    "  -i file                  Read hosts from file instead of stdin\n";
 }
 
 void validate(TraceOptions options) {
@@ -177,6 +493,14 @@ void validate(TraceOptions options) {
         throw std::runtime_error("sendwait must be at least 0");
     }
 
+    if (options.rate < 0) {
+        throw std::runtime_error("rate must be at least 0");
+    }
+
+    if (options.burst < 1) {
+        throw std::runtime_error("burst must be greater than 0");
+    }
+
     if (options.waittime < 0) {
         throw std::runtime_error("waittime must be at least 0");
     }
@@ -192,25 +516,84 @@ void validate(TraceOptions options) {
     if (options.start_ttl > options.max_ttl) {
         throw std::runtime_error("start_tll must be less than or equal to max_ttl");
     }
-}
 
-TraceOptions get_args(int argc, char *const argv[], vector<std::string> &hosts_to_trace) {
-    // Defaults
-    TraceOptions options = {};
+    if (options.resolvers < 1) {
+        throw std::runtime_error("Number of resolvers must be greater than 0");
+    }
 
-    options.af_if_unknown   = DEF_AF_IN_UNKNOWN;
-    options.probes          = DEF_PROBES;
-    options.sendwait        = DEF_SENDWAIT;
-    options.waittime        = DEF_WAITTIME;
-    options.start_ttl       = DEF_START_TTL;
-    options.max_ttl         = DEF_MAX_TTL;
-    options.map_ip_to_host  = DEF_MAP_IP_TO_HOST;
+    if (options.reorder_buffer < 0) {
+        throw std::runtime_error("reorder buffer must be at least 0");
+    }
 
-    std::string input_file;
+    if (options.window < 0) {
+        throw std::runtime_error("window must be at least 0");
+    }
+
+    if (options.doubletree_hop < 0 || options.doubletree_hop > 255) {
+        throw std::runtime_error("doubletree hop must be a number in range [0, 255]");
+    }
+
+    if (options.gap_limit < 0) {
+        throw std::runtime_error("gap limit must be at least 0");
+    }
+
+    if (options.min_waittime < 0 || options.min_waittime > options.waittime) {
+        throw std::runtime_error("min-wait must be a number in range [0, waittime]");
+    }
+
+    if (options.packet_ring && options.io_uring) {
+        throw std::runtime_error("packet rings cannot be used with io_uring");
+    }
+}
+
+/*
+ * Function parses the options, operands are stored in hosts_to_trace. If there are none,
+ * hosts are to be read from input_file (empty for stdin).
+ */
+TraceOptions get_args(int argc, char *const argv[], vector<std::string> &hosts_to_trace, std::string &input_file) {
+    TraceOptions options = default_trace_options();
+
+    input_file.clear();
+
+    // Long options without a short equivalent
+    constexpr int OPT_RATE = 256;
+    constexpr int OPT_BURST = 257;
+    constexpr int OPT_STREAM = 258;
+    constexpr int OPT_REORDER_BUFFER = 259;
+    constexpr int OPT_WINDOW = 260;
+    constexpr int OPT_STATELESS = 261;
+    constexpr int OPT_DOUBLETREE = 262;
+    constexpr int OPT_GAP_LIMIT = 263;
+    constexpr int OPT_MIN_WAIT = 264;
+    constexpr int OPT_HOP_DISTANCE = 265;
+    constexpr int OPT_DESCENDING = 266;
+    constexpr int OPT_DISTANCE_CACHE = 267;
+    constexpr int OPT_PACKET_RING = 268;
+    constexpr int OPT_IO_URING = 269;
+    constexpr int OPT_SHARDS = 270;
+
+    const struct option long_options[] = {
+        {"rate", required_argument, nullptr, OPT_RATE},
+        {"burst", required_argument, nullptr, OPT_BURST},
+        {"stream", optional_argument, nullptr, OPT_STREAM},
+        {"reorder-buffer", required_argument, nullptr, OPT_REORDER_BUFFER},
+        {"window", required_argument, nullptr, OPT_WINDOW},
+        {"stateless", no_argument, nullptr, OPT_STATELESS},
+        {"doubletree", optional_argument, nullptr, OPT_DOUBLETREE},
+        {"gap-limit", required_argument, nullptr, OPT_GAP_LIMIT},
+        {"min-wait", required_argument, nullptr, OPT_MIN_WAIT},
+        {"hop-distance", no_argument, nullptr, OPT_HOP_DISTANCE},
+        {"descending", no_argument, nullptr, OPT_DESCENDING},
+        {"distance-cache", required_argument, nullptr, OPT_DISTANCE_CACHE},
+        {"packet-ring", no_argument, nullptr, OPT_PACKET_RING},
+        {"io-uring", no_argument, nullptr, OPT_IO_URING},
+        {"shards", required_argument, nullptr, OPT_SHARDS},
+        {nullptr, 0, nullptr, 0},
+    };
 
     int opt;
     opterr = 0;
-    while ((opt = getopt(argc, argv, "46hf:m:np:z:w:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "46hf:m:np:z:w:j:sc:i:", long_options, nullptr)) != -1) {
         switch (opt) {
             case '4':
                 options.af_if_unknown = AddressFamily::Inet;
@@ -236,6 +619,72 @@ TraceOptions get_args(int argc, char *const argv[], vector<std::string> &hosts_t
             case 'w':
                 options.waittime = std::stoi(optarg);
                 break;
+            case OPT_RATE:
+                options.rate = std::stod(optarg);
+                break;
+            case OPT_BURST:
+                options.burst = std::stoi(optarg);
+                break;
+            case OPT_STREAM:
+                options.stream = true;
+
+                if (optarg == nullptr || std::string(optarg) == "done") {
+                    options.stream_input_order = false;
+                } else if (std::string(optarg) == "input") {
+                    options.stream_input_order = true;
+                } else {
+                    throw std::runtime_error("stream order must be done or input");
+                }
+                break;
+            case OPT_REORDER_BUFFER:
+                options.reorder_buffer = std::stoi(optarg);
+                break;
+            case OPT_WINDOW:
+                options.window = std::stoi(optarg);
+                break;
+            case OPT_STATELESS:
+                options.stateless = true;
+                break;
+            case OPT_DOUBLETREE:
+                options.doubletree_hop = (optarg == nullptr) ? DEF_DOUBLETREE_START : std::stoi(optarg);
+                break;
+            case OPT_GAP_LIMIT:
+                options.gap_limit = std::stoi(optarg);
+                break;
+            case OPT_MIN_WAIT:
+                options.min_waittime = std::stoi(optarg);
+                break;
+            case OPT_HOP_DISTANCE:
+                options.hop_distance = true;
+                break;
+            case OPT_DESCENDING:
+                options.hop_distance = true;
+                options.descending = true;
+                break;
+            case OPT_DISTANCE_CACHE:
+                options.distance_cache_file = optarg;
+                break;
+            case OPT_PACKET_RING:
+                options.packet_ring = true;
+                break;
+            case OPT_IO_URING:
+                options.io_uring = true;
+                break;
+            case OPT_SHARDS:
+                options.shards = std::stoi(optarg);
+                break;
+            case 'i':
+                input_file = optarg;
+                break;
+            case 'j':
+                options.resolvers = std::stoi(optarg);
+                break;
+            case 's':
+                options.show_stats = true;
+                break;
+            case 'c':
+                options.ptr_cache_file = optarg;
+                break;
             case 'h':
                 std::cout << help(argv[0]);
                 exit(EXIT_SUCCESS);
@@ -249,37 +698,129 @@ TraceOptions get_args(int argc, char *const argv[], vector<std::string> &hosts_t
 
     hosts_to_trace.clear();
 
-    if (optind < argc) {
-        for (int i = optind; i < argc; ++i) {
-            hosts_to_trace.push_back(argv[i]);
-        }
-    } else {
-        std::string host;
-        while (std::cin >> host) {
-            hosts_to_trace.push_back(host);
-        }
+    for (int i = optind; i < argc; ++i) {
+        hosts_to_trace.push_back(argv[i]);
+    }
+
+    // Finished destinations have to be forgotten to make room for new ones, stateless
+    // probing has no routes to keep
+    if (options.window > 0 || options.stateless) {
+        options.stream = true;
     }
 
     return options;
 }
 
+/*
+ * Function opens the file hosts are read from with the rights of the user who runs the
+ * program, so that a set-user-ID mulroute does not read (and echo back in its errors)
+ * files its caller could not. Nothing else runs yet, the effective ids can be switched.
+ */
+std::shared_ptr<std::ifstream> open_input(const std::string &path) {
+    uid_t euid = geteuid();
+    gid_t egid = getegid();
+    bool switch_ids = runs_setuid();
+
+    // Group goes first, changing it needs the owner's rights
+    if (switch_ids && (setegid(getgid()) == -1 || seteuid(getuid()) == -1)) {
+        throw std::system_error(errno, std::generic_category(), "Could not drop privileges");
+    }
+
+    std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(path);
+
+    if (switch_ids && (seteuid(euid) == -1 || setegid(egid) == -1)) {
+        throw std::system_error(errno, std::generic_category(), "Could not restore privileges");
+    }
+
+    if (!*file) {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    return file;
+}
+
 int main(int argc, char *const argv[]) {
     vector<std::string> hosts_to_trace;
+    std::string input_file;
 
     try {
-        TraceOptions options = get_args(argc, argv, hosts_to_trace);
+        TraceOptions options = get_args(argc, argv, hosts_to_trace, input_file);
         validate(options);
 
-        TraceResult res = multi_traceroute(hosts_to_trace, options);
+        // Input is shared with the thread which reads it, which may outlive this block
+        std::shared_ptr<std::ifstream> file;
+        std::istream *input = &std::cin;
+
+        if (hosts_to_trace.empty() && !input_file.empty()) {
+            file = open_input(input_file);
+            input = file.get();
+        }
+
+        /*
+         * With a window hosts are read only as they are needed, so the input may be of any
+         * length (or never end). A thread of its own reads it, a run which fails closes the
+         * source and ends without waiting for the input. Otherwise all hosts are read up front.
+         */
+        std::shared_ptr<HostSource> hosts;
+
+        if (!hosts_to_trace.empty()) {
+            hosts = std::make_shared<HostSource>(hosts_to_trace);
+        } else if (options.window > 0) {
+            hosts = std::make_shared<HostSource>(static_cast<size_t>(options.window));
+
+            std::thread([hosts, file, input]() {
+                std::string host;
+                while (*input >> host && hosts->push(host)) {
+                }
+
+                hosts->close();
+            }).detach();
+        } else {
+            std::string host;
+            while (*input >> host) {
+                hosts_to_trace.push_back(host);
+            }
+
+            hosts = std::make_shared<HostSource>(hosts_to_trace);
+        }
+
+        if (options.stateless) {
+            ReplyPrinter printer(options);
+            TraceResult res = multi_traceroute(*hosts, options, &printer);
+
+            if (options.show_stats) {
+                print_stats(res);
+            }
+
+            exit(EXIT_SUCCESS);
+        }
 
-        print_routes(res.probes_info_ip4, res.dest_ip4, options);
+        if (options.stream) {
+            StreamPrinter printer(options);
+            TraceResult res = multi_traceroute(*hosts, options, &printer);
+            printer.finish();
+
+            if (options.show_stats) {
+                print_stats(res);
+            }
+
+            exit(EXIT_SUCCESS);
+        }
+
+        TraceResult res = multi_traceroute(*hosts, options);
+
+        print_routes(res.probes_ip4, res.dest_ip4, options);
 
         // A newline between IPv4 and IPv6 addresses
         if (res.dest_ip4.size() > 0 && res.dest_ip6.size() > 0) {
             std::cout << std::endl;
         }
 
-        print_routes(res.probes_info_ip6, res.dest_ip6, options);
+        print_routes(res.probes_ip6, res.dest_ip6, options);
+
+        if (options.show_stats) {
+            print_stats(res);
+        }
     } catch (const std::exception &e) {
         std::cerr << "Caught exception: " << e.what() << std::endl;
         exit(EXIT_FAILURE);
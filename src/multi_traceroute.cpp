@@ -7,432 +7,974 @@
 #include "net/GaiException.h"
 #include "net/utility.h"
 #include "net/Socket.h"
-#include "net/IcmpHeader.h"
+#include "net/FamilyTraits.h"
+#include "net/Resolver.h"
+#include "net/ReverseResolver.h"
+#include "net/PtrCache.h"
+#include "net/DistanceCache.h"
+#include "RatePacer.h"
+#include "DestFeed.h"
+#include "Prober.h"
+#include "ProbeCodec.h"
+#include "net/EventLoop.h"
 
-#include <netinet/ip.h>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <tuple>
 #include <memory>
 #include <random>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <exception>
 #include <cstdlib>
+#include <cstdint>
 #include <map>
+#include <algorithm>
+#include <stdexcept>
 
 #include <cstdio>
-
-// SEQ and ID are 16bit unsigned numbers
-constexpr int ICMP_SEQ_ID_MAX = (1 << 16) - 1;
-
-constexpr int DEF_TTL_DONE = 100;
-constexpr int RECV_TIMEOUT_SEC = 0;
-constexpr int RECV_TIMEOUT_USEC = 200000;
-constexpr int RECV_BUF_SIZE = 1500;
-constexpr int MIN_IP4_HDR_LEN = 20;
-constexpr int MIN_IP6_HDR_LEN = 40;
-constexpr int ICMP_HDR_LEN = 8;
+#include <sched.h>
+
+// ICMP ID and SEQ together tell apart 2^32 probes of one address family
+constexpr uint64_t PROBE_TAGS = uint64_t(1) << 32;
+
+// Minimal time between two updates of the progress line
+constexpr int PROGRESS_INTERVAL_MS = 100;
+
+// Event loop tokens of the timers and the feed of failed lookups, prober k uses 2k for
+// its feed and 2k + 1 for its replies
+constexpr int PACE_TOKEN = -1;
+constexpr int RETIRE_TOKEN = -2;
+constexpr int ERROR_FEED_TOKEN = -3;
+constexpr int HOLD_TOKEN = -4;
+constexpr int CANCEL_TOKEN = -5;
+
+// Defaults of the options, those of the command line tool too
+constexpr AddressFamily DEF_AF_IN_UNKNOWN = AddressFamily::Inet;
+constexpr int DEF_PROBES = 3;
+constexpr int DEF_SENDWAIT = 10;
+constexpr double DEF_RATE = 0;
+constexpr int DEF_BURST = 16;
+constexpr int DEF_WAITTIME = 500;
+constexpr int DEF_START_TTL = 1;
+constexpr int DEF_MAX_TTL = 30;
+constexpr bool DEF_MAP_IP_TO_HOST = true;
+constexpr int DEF_RESOLVERS = 16;
+constexpr bool DEF_SHOW_STATS = false;
+constexpr int DEF_PTR_CACHE_TTL = 24 * 60 * 60;
+constexpr bool DEF_STREAM = false;
+constexpr int DEF_REORDER_BUFFER = 1024;
+constexpr int DEF_WINDOW = 0;
+constexpr bool DEF_STATELESS = false;
+constexpr int DEF_DOUBLETREE_HOP = 0;
+constexpr int DEF_GAP_LIMIT = 0;
+constexpr int DEF_MIN_WAITTIME = 0;
+constexpr bool DEF_HOP_DISTANCE = false;
+constexpr bool DEF_DESCENDING = false;
+constexpr int DEF_DISTANCE_CACHE_TTL = 7 * 24 * 60 * 60;
+constexpr bool DEF_PACKET_RING = false;
+constexpr bool DEF_IO_URING = false;
+constexpr int DEF_SHARDS = 1;
 
 using std::vector;
 
-inline int get_ip_hdr_len(AddressFamily af, char *ip_hdr) {
-    if (af == AddressFamily::Inet) {
-        struct ip *ip4_p = (struct ip *) ip_hdr;
-        return ip4_p->ip_hl << 2;
-    } else {
-        // IPv6 headers are fixed length (40 bytes)
-        return MIN_IP6_HDR_LEN;
+/*
+ * Default cache file is $XDG_CACHE_HOME/mulroute/ptr_cache or ~/.cache/mulroute/ptr_cache.
+ * A set-user-ID process gets none, its environment is chosen by the caller.
+ */
+std::string default_ptr_cache_file() {
+    if (runs_setuid()) {
+        return "";
     }
-}
 
-inline int min_ip_hdr_len(AddressFamily af) {
-    if (af == AddressFamily::Inet) {
-        return MIN_IP4_HDR_LEN;
-    } else {
-        return MIN_IP6_HDR_LEN;
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home != nullptr && *cache_home) {
+        return std::string(cache_home) + "/mulroute/ptr_cache";
     }
-}
-
 
-/*
- * Every ICMP Echo Request packet has ID and SEQ_NUMBER.
- * We use these numbers to match our EchoRequests to replies.
- * First a random id_offset and seq_offset is computed.
- *    ID holds the information about destination (index in vector of destinations)
- *    and is computed as:
- *      id_offset + dest_index
- *
- *    SEQ holds information about ttl and probe number. We compute it as
- *      seq_offset + (ttl - 1) * max_probes + probes
- *      (considering ttl starts with 1)
- */
+    const char *home = getenv("HOME");
+    if (home != nullptr && *home) {
+        return std::string(home) + "/.cache/mulroute/ptr_cache";
+    }
 
-inline int dest_to_id(int dest_ind, int id_offset) {
-    return id_offset + dest_ind;
+    return "";
 }
 
-inline int id_to_dest(int id, int id_offset) {
-    return id - id_offset;
+TraceOptions default_trace_options() {
+    TraceOptions options = {};
+
+    options.af_if_unknown   = DEF_AF_IN_UNKNOWN;
+    options.probes          = DEF_PROBES;
+    options.sendwait        = DEF_SENDWAIT;
+    options.rate            = DEF_RATE;
+    options.burst           = DEF_BURST;
+    options.waittime        = DEF_WAITTIME;
+    options.start_ttl       = DEF_START_TTL;
+    options.max_ttl         = DEF_MAX_TTL;
+    options.map_ip_to_host  = DEF_MAP_IP_TO_HOST;
+    options.resolvers       = DEF_RESOLVERS;
+    options.show_stats      = DEF_SHOW_STATS;
+    options.ptr_cache_file  = default_ptr_cache_file();
+    options.ptr_cache_ttl   = DEF_PTR_CACHE_TTL;
+    options.stream          = DEF_STREAM;
+    options.reorder_buffer  = DEF_REORDER_BUFFER;
+    options.window          = DEF_WINDOW;
+    options.stateless       = DEF_STATELESS;
+    options.doubletree_hop  = DEF_DOUBLETREE_HOP;
+    options.gap_limit       = DEF_GAP_LIMIT;
+    options.min_waittime    = DEF_MIN_WAITTIME;
+    options.hop_distance    = DEF_HOP_DISTANCE;
+    options.descending      = DEF_DESCENDING;
+    options.distance_cache_ttl = DEF_DISTANCE_CACHE_TTL;
+    options.distance_cache_file.clear();
+    options.packet_ring     = DEF_PACKET_RING;
+    options.io_uring        = DEF_IO_URING;
+    options.shards          = DEF_SHARDS;
+
+    return options;
 }
 
-inline int probe_to_seq(int ttl, int probes, int p, int seq_offset) {
-    return seq_offset + (ttl - 1) * probes + p;
-}
+/* Probes per second to send, --rate takes precedence over sendwait. 0 means no limit. */
+inline double probe_rate(const TraceOptions &options) {
+    if (options.rate > 0) {
+        return options.rate;
+    }
 
-inline int seq_to_ttl(int seq, int probes, int seq_offset) {
-    return (seq - seq_offset) / probes + 1;
+    return (options.sendwait > 0) ? 1000.0 / options.sendwait : 0;
 }
 
-inline int seq_to_probe(int seq, int probes, int seq_offset) {
-    return (seq - seq_offset) % probes;
+/*
+ * Function moves failed lookups from the feed to dest_error. When streaming, they are
+ * handed to the sink instead.
+ */
+void fetch_errors(DestFeed &feed_error, vector<DestInfo> &dest_error, RouteSink *sink) {
+    size_t old_count = dest_error.size();
+    feed_error.fetch(dest_error);
+
+    if (sink != nullptr) {
+        for (size_t i = old_count; i < dest_error.size(); ++i) {
+            sink->route_failed(dest_error[i]);
+        }
+
+        dest_error.resize(old_count);
+    }
 }
 
 /*
- * Function sends options.max_probes for every ttl (up to options.max_ttl)
- * to every destination in dest vector.
+ * Function drives all probers (one per address family) from a single epoll loop, so
+ * the families are traced at the same time. The loop watches the feeds, the replies
+ * published by the probers' receiving threads and three timers:
+ *   - pace timer is armed when the pacer runs out of tokens and there is still
+ *     something to send,
+ *   - retire timer is armed to the time the next destination finishes (its probes are
+ *     answered or timed out), destinations which get all replies earlier finish then,
+ *   - hold timer is armed when no prober can send because all their destinations wait
+ *     for silent hops to time out (gap limit).
+ * The run ends as soon as every probe is sent and no destination is waiting for replies.
+ * The loop only polls (without sleeping) while there are probes it may send right away.
  *
- * dest         - a vector containing destinations for sending probes
- * ttl_done     - a vector where k-th element is the smallest ttl of packet which reached k-th
- *                destination from dest vector
- * probes_info  - information about every probe sent
+ * A shard passes no feed_error (another shard takes the failed lookups) and its
+ * progress, which it stores instead of printing the progress line itself. The loop
+ * stops right away once cancel is readable, unfinished destinations are not retired.
  */
-void send_probes(AddressFamily af,
-                 const vector<DestInfo> &dest,
-                 const vector<int> &ttl_done,
-                 vector<vector<vector<ProbeInfo>>> &probes_info,
-                 int id_offset,
-                 int seq_offset,
-                 TraceOptions options)
+void run_probers(vector<Prober *> &probers,
+                 vector<DestFeed *> &feeds,
+                 DestFeed *feed_error,
+                 vector<DestInfo> &dest_error,
+                 RouteSink *sink,
+                 SendStats &send_stats,
+                 RecvStats &recv_stats,
+                 const TraceOptions &options,
+                 const Notifier *cancel = nullptr,
+                 std::atomic<size_t> *progress = nullptr)
 {
-    Socket sock = Socket(af, SocketType::Raw, (af == AddressFamily::Inet) ? Protocol::ICMP : Protocol::ICMPv6);
+    EventLoop loop;
+    Timer pace_timer, retire_timer, hold_timer;
+    RatePacer pacer(probe_rate(options), options.burst);
 
-    // Initialize ICMP echo request packet with message 'abraham'
-    vector<char> payload = {'a', 'b', 'r', 'a', 'h', 'a', 'm'};
-    std::shared_ptr<IcmpHeader> icmp_hdr;
+    loop.add(pace_timer.get_fd(), PACE_TOKEN);
+    loop.add(retire_timer.get_fd(), RETIRE_TOKEN);
+    loop.add(hold_timer.get_fd(), HOLD_TOKEN);
 
-    if (af == AddressFamily::Inet) {
-        icmp_hdr = std::make_shared<Icmp4Header>(id_offset, seq_offset, payload, payload.size());
-    } else {
-        icmp_hdr = std::make_shared<Icmp6Header>(id_offset, seq_offset, payload, payload.size());
+    if (feed_error != nullptr) {
+        loop.add(feed_error->get_notifier().get_fd(), ERROR_FEED_TOKEN);
     }
 
-    for (int ttl = options.start_ttl; ttl <= options.max_ttl; ++ttl) {
-        sock.set_ttl(ttl);
+    if (cancel != nullptr) {
+        loop.add(cancel->get_fd(), CANCEL_TOKEN);
+    }
+
+    for (size_t k = 0; k < feeds.size(); ++k) {
+        loop.add(feeds[k]->get_notifier().get_fd(), 2 * k);
+        loop.add(probers[k]->get_fd(), 2 * k + 1);
+    }
 
-        for (int p = 0; p < options.probes; ++p) {
-            icmp_hdr->set_seq(probe_to_seq(ttl, options.probes, p, seq_offset));
+    vector<int> tokens;
+    size_t first_prober = 0;
+    bool any_sent = false, cancelled = false;
+    std::chrono::steady_clock::time_point first_send, last_send, last_progress;
+    auto retire_at = std::chrono::steady_clock::time_point::max();
+    auto hold_at = std::chrono::steady_clock::time_point::max();
 
-            for (size_t i = 0; i < dest.size(); ++i) {
-                // Destination is already reached
-                if (ttl_done[i] < ttl) {
+    while (true) {
+        // Every prober gets a batch of what the pacer allows, the first one alternates
+        if (!pace_timer.is_armed()) {
+            for (size_t j = 0; j < probers.size(); ++j) {
+                Prober *prober = probers[(first_prober + j) % probers.size()];
+
+                if (!prober->has_work()) {
                     continue;
                 }
 
-                icmp_hdr->set_id(dest_to_id(i, id_offset));
-                icmp_hdr->prep_to_send();
+                size_t allowed = pacer.available(SEND_BATCH_MAX);
+                if (allowed == 0) {
+                    pace_timer.set(pacer.next_token_time());
+                    break;
+                }
 
-                probes_info[i][ttl - options.start_ttl][p].send_time = std::chrono::steady_clock::now();
+                size_t sent = prober->send(allowed);
+                pacer.consume(sent);
 
-                sock.send(icmp_hdr->get_packet_ptr(), icmp_hdr->get_length(), dest[i].address);
-                std::this_thread::sleep_for(std::chrono::milliseconds(options.sendwait));
+                if (sent > 0) {
+                    last_send = std::chrono::steady_clock::now();
+
+                    if (!any_sent) {
+                        first_send = last_send;
+                        any_sent = true;
+                    }
+                }
             }
+
+            first_prober = (first_prober + 1) % probers.size();
         }
-    }
-}
 
-/*
- * Function is receiving all ICMP packets of given address family. If the packet is
- * our probe (based on ID and SEQ), information about it are updated in probes_info vector.
- *
- * Since this function will run simultaneously with send_probes, we need to know when to stop it.
- * Variable all_sent is used exactly for this - when all probes are sent, all_sent variable is set to
- * true and we stop receiving roughly after options.waittime miliseconds.
- *
- * ttl_done     - a vector where k-th element is the smallest ttl of packet which reached k-th
- *                destination from dest vector (used in send_probes).
- */
-void recv_probes(AddressFamily af,
-                 vector<int> &ttl_done,
-                 bool &all_sent,
-                 vector<vector<vector<ProbeInfo>>> &probes_info,
-                 int id_offset,
-                 int seq_offset,
-                 TraceOptions options)
-{
-    std::shared_ptr<Socket> sock;
-    try {
-        sock = std::make_shared<Socket>(af, SocketType::Raw, (af == AddressFamily::Inet) ? Protocol::ICMP : Protocol::ICMPv6);
-    } catch (const std::exception &e) {
-        return;
-    }
+        // Shards take more destinations once sending ends a pass with room, their feeds do
+        // not tell them
+        for (Prober *prober : probers) {
+            if (prober->wants_dests()) {
+                prober->fetch_dests();
+            }
+        }
 
-    bool timeout_started = false;
-    std::chrono::steady_clock::time_point all_sent_time;
+        bool all_done = true, can_send = false;
+        auto held_until = std::chrono::steady_clock::time_point::max();
 
-    Address from;
-    char recv_buf[RECV_BUF_SIZE];
+        for (Prober *prober : probers) {
+            all_done = all_done && prober->is_done();
+            can_send = can_send || prober->has_work();
+            held_until = std::min(held_until, prober->get_held_until());
+        }
 
-    int count_received = 0;
+        // Timer is rearmed only when the time changes, like the retire timer below
+        auto next_hold = can_send ? std::chrono::steady_clock::time_point::max() : held_until;
 
-    while (true) {
-        std::cout << "\rReceiving packets: " << count_received << std::flush;
-
-        if (all_sent) {
-            /*
-             * All probes have been sent, we start timeout of options.waittime miliseconds and then
-             * terminate.
-             */
-            if (timeout_started) {
-                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-                if (std::chrono::duration_cast<std::chrono::milliseconds>(now - all_sent_time).count() > options.waittime) {
-                    break;
-                }
+        if (next_hold != hold_at) {
+            if (next_hold == std::chrono::steady_clock::time_point::max()) {
+                hold_timer.disarm();
             } else {
-                all_sent_time = std::chrono::steady_clock::now();
-                timeout_started = true;
+                hold_timer.set(next_hold);
             }
+
+            hold_at = next_hold;
         }
 
-        /*
-         * Passively wait at most RECV_TIMEOUT_SEC seconds + RECV_TIMEOUT_USEC microseconds for
-         * socket to be ready for reading.
-         */
-        if (!sock->wait_for_recv(RECV_TIMEOUT_SEC, RECV_TIMEOUT_USEC)) {
-            continue;
+        auto now = std::chrono::steady_clock::now();
+        auto next_retire = std::chrono::steady_clock::time_point::max();
+
+        for (Prober *prober : probers) {
+            next_retire = std::min(next_retire, prober->retire(now, sink));
+        }
+
+        if (all_done && next_retire == std::chrono::steady_clock::time_point::max()) {
+            break;
         }
 
-        auto recv_time = std::chrono::steady_clock::now();
-        int n_bytes = sock->recv(recv_buf, RECV_BUF_SIZE, from);
-
-        /*
-         *                                 ICMPv4 ERROR responses
-         *
-         *   ***************** ***************** ***************** ***************************
-         *   *  IPv4 header  * *  ICMPv4 error * *  IPv4 header  * *  original ICMPv4 header *
-         *   *   ~20 bytes   * *    8 bytes    * *   ~20 bytes   * *          8 bytes        *
-         *   ***************** ***************** ***************** ***************************
-         *
-         *  Echo replies contain IPv4 header and ICMPv4 Echo reply message
-         *
-         *                                  ICMPv6 ERROR responses
-         *
-         *             ***************** ***************** ***************************
-         *             *  ICMPv6 error * *  IPv6 header  * *  original ICMPv6 header *
-         *             *    8 bytes    * *    40 bytes   * *          8 bytes        *
-         *             ***************** ***************** ***************************
-         *
-         *  Echo replies contain only ICMPv6 Echo reply message
-         */
-
-        std::shared_ptr<IcmpHeader> icmp_hdr;
-        int ip_hdr_len1, ip_hdr_len2;
-
-        if (af == AddressFamily::Inet) {
-
-            // Is enough bytes received for EchoReply
-            if (n_bytes < min_ip_hdr_len(af) + ICMP_HDR_LEN) {
-                continue;
+        // Timer is rearmed only when the next finishing destination changes
+        if (next_retire != retire_at) {
+            if (next_retire == std::chrono::steady_clock::time_point::max()) {
+                retire_timer.disarm();
+            } else {
+                retire_timer.set(next_retire);
             }
 
-            ip_hdr_len1 = get_ip_hdr_len(AddressFamily::Inet, recv_buf);
-            icmp_hdr = std::make_shared<Icmp4Header>(recv_buf + ip_hdr_len1, n_bytes - ip_hdr_len1);
-        } else {
+            retire_at = next_retire;
+        }
+
+        loop.wait(tokens, (can_send && !pace_timer.is_armed()) ? 0 : -1);
 
-            if (n_bytes < ICMP_HDR_LEN) {
-                continue;
+        // Other shards watch the same descriptor, so it is left readable
+        if (std::find(tokens.begin(), tokens.end(), CANCEL_TOKEN) != tokens.end()) {
+            cancelled = true;
+            break;
+        }
+
+        for (int token : tokens) {
+            if (token == PACE_TOKEN) {
+                pace_timer.consume();
+            } else if (token == HOLD_TOKEN) {
+                hold_timer.consume();
+                hold_at = std::chrono::steady_clock::time_point::max();
+            } else if (token == RETIRE_TOKEN) {
+                retire_timer.consume();
+                retire_at = std::chrono::steady_clock::time_point::max();
+            } else if (token == ERROR_FEED_TOKEN) {
+                feed_error->get_notifier().consume();
+                fetch_errors(*feed_error, dest_error, sink);
+            } else if (token % 2 == 0) {
+                feeds[token / 2]->get_notifier().consume();
+                probers[token / 2]->fetch_dests();
+            } else {
+                probers[token / 2]->apply_replies();
             }
+        }
 
-            // No IPv6 header to process in case of IPv6
-            ip_hdr_len1 = 0;
-            icmp_hdr = std::make_shared<Icmp6Header>(recv_buf, n_bytes - ip_hdr_len1);
+        if (progress != nullptr) {
+            progress->store(recv_stats.probes_matched, std::memory_order_relaxed);
+            continue;
+        }
+
+        now = std::chrono::steady_clock::now();
+
+        if (sink == nullptr && now - last_progress > std::chrono::milliseconds(PROGRESS_INTERVAL_MS)) {
+            std::cout << "\rReceiving packets: " << recv_stats.probes_matched << std::flush;
+            last_progress = now;
         }
+    }
+
+    if (any_sent) {
+        send_stats.tail = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - last_send);
+    }
 
-        IcmpRespStatus icmp_status = icmp_hdr->get_resp_status();
+    for (Prober *prober : probers) {
+        prober->finish();
+    }
 
-        switch (icmp_status) {
-            case IcmpRespStatus::Unknown:
-                continue;
-            case IcmpRespStatus::EchoReply:
-                break;
-            default: {
-                // Is enough bytes received for error
-                if (n_bytes < ip_hdr_len1 + ICMP_HDR_LEN + min_ip_hdr_len(af) + 8) {
+    if (feed_error != nullptr && !cancelled) {
+        fetch_errors(*feed_error, dest_error, sink);
+    }
+
+    // Stateless replies applied by finish() still go to the sink
+    for (Prober *prober : probers) {
+        if (!cancelled) {
+            prober->retire(std::chrono::steady_clock::time_point::max(), sink);
+        }
+    }
+
+    if (sink == nullptr && progress == nullptr) {
+        std::cout << "\r" << std::flush;
+    }
+
+    send_stats.duration = std::chrono::duration_cast<std::chrono::microseconds>(last_send - first_send);
+}
+
+/*
+ * Function hands out the resolver's results as they complete - successfully resolved
+ * destinations go to a feed of their address family (one per shard, in turns), the rest
+ * to feed_error. All feeds are closed at the end.
+ */
+void dispatch_resolved(Resolver &resolver,
+                       vector<DestFeed *> &feeds_ip4,
+                       vector<DestFeed *> &feeds_ip6,
+                       DestFeed &feed_error)
+{
+    ResolveResult result;
+    size_t next_ip4 = 0, next_ip6 = 0;
+
+    while (resolver.next(result)) {
+        const std::string &ip_or_hostname = result.host;
+
+        if (result.gai_code) {
+            GaiException e(result.gai_code);
+            std::cerr << "Skipping \"" << ip_or_hostname << "\", an exception was caught: "
+                      << "\n\tError code: " << e.code() << " " << e.what() << "\n" << std::endl;
+
+            feed_error.push(DestInfo(Address(), ip_or_hostname, false, result.index));
+        } else if (result.address.get_family() == AddressFamily::Inet) {
+            feeds_ip4[next_ip4]->push(DestInfo(result.address, ip_or_hostname, true, result.index));
+            next_ip4 = (next_ip4 + 1) % feeds_ip4.size();
+        } else {
+            feeds_ip6[next_ip6]->push(DestInfo(result.address, ip_or_hostname, true, result.index));
+            next_ip6 = (next_ip6 + 1) % feeds_ip6.size();
+        }
+    }
+
+    for (DestFeed *feed : feeds_ip4) {
+        feed->close();
+    }
+
+    for (DestFeed *feed : feeds_ip6) {
+        feed->close();
+    }
+
+    feed_error.close();
+}
+
+/*
+ * Destinations are probed in the order their lookups finished. Function puts them (and
+ * their probes) back into the order the user gave them in.
+ */
+void restore_input_order(vector<DestInfo> &dest, ProbeTable &probes) {
+    vector<size_t> order(dest.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return dest[a].input_ind < dest[b].input_ind;
+    });
+
+    vector<DestInfo> sorted_dest;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        sorted_dest.push_back(dest[order[i]]);
+    }
+
+    dest.swap(sorted_dest);
+    probes.reorder(order);
+}
+
+/*
+ * Function fills in hostnames of all offenders. Lookups were already done by
+ * ReverseResolver during probing, IPs that failed to resolve keep their IP as hostname.
+ */
+void lookup_hostnames(ProbeTable &probes, PtrCache &cache) {
+    for (Address &hop : probes.get_hops()) {
+        std::string ip = hop.get_ip_str();
+        std::string hostname;
+
+        if (!cache.get(ip, hostname)) {
+            hostname = ip;
+        }
+
+        hop.set_hostname(hostname);
+    }
+}
+
+/*
+ * Class NamingSink fills in hostnames of a streamed route's hops from the cache before
+ * passing the route on. Lookups of hops seen only in the last moments before the
+ * destination finished may not be done yet, those hops keep their IP as hostname.
+ */
+class NamingSink : public RouteSink {
+public:
+    NamingSink(RouteSink &sink, PtrCache &cache) : sink_(sink), cache_(cache) { }
+
+    void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) override {
+        for (int ttl = 0; ttl < probes.get_ttls(); ++ttl) {
+            for (int p = 0; p < probes.get_probes(); ++p) {
+                size_t slot = probes.slot(dest_ind, ttl, p);
+
+                if (!probes.did_arrive(slot)) {
                     continue;
                 }
 
-                ip_hdr_len2 = get_ip_hdr_len(af, recv_buf + ip_hdr_len1 + ICMP_HDR_LEN);
+                Address &offender = probes.get_offender(slot);
+                std::string ip = offender.get_ip_str();
+                std::string hostname;
 
-                if (af == AddressFamily::Inet) {
-                    icmp_hdr = std::make_shared<Icmp4Header>(
-                        recv_buf + ip_hdr_len1 + ICMP_HDR_LEN + ip_hdr_len2,
-                        n_bytes - ip_hdr_len1 - ICMP_HDR_LEN - ip_hdr_len2);
-                } else {
-                    icmp_hdr = std::make_shared<Icmp6Header>(
-                        recv_buf + ICMP_HDR_LEN + ip_hdr_len2,
-                        n_bytes - ICMP_HDR_LEN - ip_hdr_len2);
+                if (!cache_.get(ip, hostname)) {
+                    hostname = ip;
                 }
+
+                offender.set_hostname(hostname);
             }
         }
 
-        int dest_ind = id_to_dest(icmp_hdr->get_id(), id_offset);
-        int ttl = seq_to_ttl(icmp_hdr->get_seq(), options.probes, seq_offset);
-        int probe_ind = seq_to_probe(icmp_hdr->get_seq(), options.probes, seq_offset);
+        sink_.route_done(dest, probes, dest_ind);
+    }
 
-        // Validate ID and SEQ
-        if (dest_ind < 0 || dest_ind >= static_cast<int>(ttl_done.size())
-            || ttl < options.start_ttl || ttl > options.max_ttl
-            || probe_ind < 0 || probe_ind > options.probes) {
-            continue;
-        }
+    void route_failed(const DestInfo &dest) override {
+        sink_.route_failed(dest);
+    }
 
-        if (icmp_status != IcmpRespStatus::TimeExceeded) {
-            // Received probe is useless, we reached destination with smaller ttl
-            if (ttl_done[dest_ind] < ttl) {
-                continue;
-            } else {
-                ttl_done[dest_ind] = ttl;
-            }
+    void reply_decoded(const DecodedReply &reply) override {
+        DecodedReply named = reply;
+        std::string ip = named.offender.get_ip_str();
+        std::string hostname;
+
+        if (!cache_.get(ip, hostname)) {
+            hostname = ip;
         }
 
-        ProbeInfo &probe_ref = probes_info[dest_ind][ttl - options.start_ttl][probe_ind];
-        probe_ref.offender = from;
-        probe_ref.did_arrive = true;
-        probe_ref.icmp_status = icmp_status;
-        probe_ref.recv_time = recv_time;
+        named.offender.set_hostname(hostname);
+        sink_.reply_decoded(named);
+    }
+
+private:
+    RouteSink &sink_;
+    PtrCache &cache_;
+};
+
+/*
+ * Class WindowSink passes streamed routes on and then lets the resolver take another
+ * host in place of the finished one.
+ */
+class WindowSink : public RouteSink {
+public:
+    WindowSink(RouteSink &sink, Resolver &resolver) : sink_(sink), resolver_(resolver) { }
+
+    void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) override {
+        sink_.route_done(dest, probes, dest_ind);
+        resolver_.release(1);
+    }
+
+    void route_failed(const DestInfo &dest) override {
+        sink_.route_failed(dest);
+        resolver_.release(1);
+    }
 
-        ++count_received;
+    void reply_decoded(const DecodedReply &reply) override {
+        sink_.reply_decoded(reply);
     }
 
-    std::cout << "\r" << std::flush;
+private:
+    RouteSink &sink_;
+    Resolver &resolver_;
+};
+
+/*
+ * Class LockedSink lets the shards stream through one sink, the sinks behind it get one
+ * call at a time.
+ */
+class LockedSink : public RouteSink {
+public:
+    LockedSink(RouteSink &sink) : sink_(sink) { }
+
+    void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sink_.route_done(dest, probes, dest_ind);
+    }
+
+    void route_failed(const DestInfo &dest) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sink_.route_failed(dest);
+    }
+
+    void reply_decoded(const DecodedReply &reply) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sink_.reply_decoded(reply);
+    }
+
+private:
+    RouteSink &sink_;
+    std::mutex mutex_;
+};
+
+/*
+ * Structure holds one shard: its part of the destinations with their probes and the
+ * probers tracing them. Nothing of it is shared with the other shards but the feeds,
+ * which they steal from, the caches and the sink.
+ */
+struct Shard {
+    Shard(int ttls, int probes) : probes_ip4(ttls, probes), probes_ip6(ttls, probes) { }
+
+    DestFeed feed_ip4, feed_ip6;
+    vector<DestInfo> dest_ip4, dest_ip6;
+    ProbeTable probes_ip4, probes_ip6;
+
+    SendStats send_stats;
+    RecvStats recv_stats;
+
+    std::unique_ptr<FamilyProber<Inet4>> prober_ip4;
+    std::unique_ptr<FamilyProber<Inet6>> prober_ip6;
+
+    // Replies matched so far, for the progress line, and what ended the shard's thread
+    std::atomic<size_t> matched{0};
+    std::exception_ptr error;
+};
+
+/* Function pins the calling thread to the k-th of the cores the process may run on */
+void pin_to_core(size_t k) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof (allowed), &allowed) == -1 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+
+    size_t n = k % CPU_COUNT(&allowed);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed) || n-- > 0) {
+            continue;
+        }
+
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+
+        // Not being pinned costs only speed
+        (void) sched_setaffinity(0, sizeof (one), &one);
+        return;
+    }
 }
 
-void send_and_recv(AddressFamily af,
-           const vector<DestInfo> &dest,
-           vector<int> &ttl_done,
-           vector<vector<vector<ProbeInfo>>> &probes_info,
-           int id_offset,
-           int seq_offset,
-           TraceOptions options)
+/*
+ * Function runs the probers of every shard. A single shard runs in the calling thread
+ * as the probers always did. Otherwise every shard gets a thread of its own, pinned to a
+ * core (the receiving threads its probers start share it), and the calling thread only
+ * prints the progress line of them all. Every shard runs its own event loop with its own
+ * sockets, pacer and probe tables, so they share nothing on the way of a probe; replies
+ * find their shard by the filters of the sockets, as the shards have disjoint ranges of
+ * probe tags. The first shard takes the failed lookups. An exception which ended any of
+ * the threads is rethrown once all of them are done.
+ */
+void run_shards(vector<std::unique_ptr<Shard>> &shards,
+                DestFeed &feed_error,
+                vector<DestInfo> &dest_error,
+                RouteSink *sink,
+                const TraceOptions &options,
+                const Notifier *cancel)
 {
-    bool all_sent = false;
-    probes_info.assign(dest.size(),
-                       vector<vector<ProbeInfo>>(options.max_ttl - options.start_ttl + 1,
-                                                 vector<ProbeInfo>(options.probes, ProbeInfo())));
-
-    std::thread t1 = std::thread(recv_probes,
-                                 af,
-                                 std::ref(ttl_done),
-                                 std::ref(all_sent),
-                                 std::ref(probes_info),
-                                 id_offset,
-                                 seq_offset,
-                                 options);
+    auto run = [&](size_t k, const TraceOptions &shard_options, std::atomic<size_t> *progress) {
+        Shard &shard = *shards[k];
+        vector<Prober *> probers = {shard.prober_ip4.get(), shard.prober_ip6.get()};
+        vector<DestFeed *> feeds = {&shard.feed_ip4, &shard.feed_ip6};
 
-    try {
-        send_probes(af, dest, ttl_done, probes_info, id_offset, seq_offset, options);
-    } catch (const std::exception &e) {
-        std::cerr << "Caught exception: " << e.what() << std::endl;
-        std::cerr << "Try running the program in a priviledged mode" << std::endl;
-        /*
-         * If sending fails, we have to set all_sent to true so that receiving terminates
-         */
-        all_sent = true;
-        t1.join();
-        exit(EXIT_FAILURE);
-    }
-
-    all_sent = true;
-    t1.join();
-}
+        run_probers(probers, feeds, (k == 0) ? &feed_error : nullptr, dest_error, sink,
+                    shard.send_stats, shard.recv_stats, shard_options, cancel, progress);
+    };
 
-void lookup_hostnames(vector<vector<vector<ProbeInfo>>> &probes_info) {
-    std::map<std::string, std::string> ips_done;
+    if (shards.size() == 1) {
+        run(0, options, nullptr);
+        return;
+    }
 
-    for (auto &dest : probes_info) {
-        for (auto &ttl : dest) {
-            for (auto &probe : ttl) {
-                if (!probe.did_arrive) {
-                    continue;
-                }
+    // Every shard sends its share of the rate
+    TraceOptions shard_options = options;
+    shard_options.rate = probe_rate(options) / shards.size();
+    shard_options.burst = std::max<int>(1, options.burst / shards.size());
 
-                std::string ip = probe.offender.get_ip_str();
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t running = shards.size();
+    vector<std::thread> threads;
 
-                if (ips_done.find(ip) == ips_done.end()) {
-                    // IP was not processed yet
-                    probe.offender.retrieve_hostname();
-                    ips_done[ip] = probe.offender.get_hostname();
-                } else {
-                    probe.offender.set_hostname(ips_done[ip]);
-                }
+    for (size_t k = 0; k < shards.size(); ++k) {
+        threads.emplace_back([&, k] {
+            pin_to_core(k);
+
+            try {
+                run(k, shard_options, &shards[k]->matched);
+            } catch (...) {
+                shards[k]->error = std::current_exception();
             }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --running;
+            finished.notify_one();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running > 0) {
+        if (sink == nullptr) {
+            size_t matched = 0;
+            for (auto &shard : shards) {
+                matched += shard->matched.load(std::memory_order_relaxed);
+            }
+
+            std::cout << "\rReceiving packets: " << matched << std::flush;
         }
+
+        finished.wait_for(lock, std::chrono::milliseconds(PROGRESS_INTERVAL_MS));
     }
+
+    lock.unlock();
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    if (sink == nullptr) {
+        std::cout << "\r" << std::flush;
+    }
+
+    for (auto &shard : shards) {
+        if (shard->error) {
+            std::rethrow_exception(shard->error);
+        }
+    }
+}
+
+/* Function adds up the statistics of the shards, times are those of the slowest one */
+void merge_stats(const Shard &shard, SendStats &send_stats, RecvStats &recv_stats) {
+    const SendStats &s = shard.send_stats;
+    send_stats.probes_sent += s.probes_sent;
+    send_stats.probes_skipped += s.probes_skipped;
+    send_stats.probes_truncated += s.probes_truncated;
+    send_stats.distances_estimated += s.distances_estimated;
+    send_stats.distances_cached += s.distances_cached;
+    send_stats.probes_out_of_range += s.probes_out_of_range;
+    send_stats.ranges_extended += s.ranges_extended;
+    send_stats.dests_stolen += s.dests_stolen;
+    send_stats.duration = std::max(send_stats.duration, s.duration);
+    send_stats.tail = std::max(send_stats.tail, s.tail);
+
+    const RecvStats &r = shard.recv_stats;
+    recv_stats.packets_received += r.packets_received;
+    recv_stats.probes_matched += r.probes_matched;
+    recv_stats.replies_rejected += r.replies_rejected;
+    recv_stats.recv_calls += r.recv_calls;
+    recv_stats.max_batch = std::max(recv_stats.max_batch, r.max_batch);
+}
+
+/* Feeds of all shards but the k-th */
+vector<DestFeed *> siblings(const vector<DestFeed *> &feeds, size_t k) {
+    vector<DestFeed *> others;
+
+    for (size_t j = 0; j < feeds.size(); ++j) {
+        if (j != k) {
+            others.push_back(feeds[j]);
+        }
+    }
+
+    return others;
 }
 
-TraceResult multi_traceroute(vector<std::string> dest_str_vec, TraceOptions options) {
+TraceResult multi_traceroute(HostSource &hosts, TraceOptions options, RouteSink *sink, const Notifier *cancel) {
     TraceResult res;
 
-    // Resolving users input addresses into Address structures
-    for (std::string ip_or_hostname : dest_str_vec) {
-        try {
-            Address dest_address = str_to_address(ip_or_hostname, options.af_if_unknown);
+    // Streaming needs someone to stream to, a window needs destinations to finish
+    options.stream = options.stream && sink != nullptr;
+    if (!options.stream) {
+        sink = nullptr;
 
-            if (dest_address.get_family() == AddressFamily::Inet) {
-                res.dest_ip4.push_back(DestInfo(dest_address, ip_or_hostname, true));
-            } else {
-                res.dest_ip6.push_back(DestInfo(dest_address, ip_or_hostname, true));
-            }
+        if (options.window > 0 || !hosts.is_counted()) {
+            throw std::runtime_error("A window of destinations and hosts read on the go need streaming");
+        }
+    }
 
-        } catch (const GaiException& e) {
-            std::cerr << "Skipping \"" << ip_or_hostname << "\", an exception was caught: "
-                      << "\n\tError code: " << e.code() << " " << e.what() << "\n" << std::endl;
+    if (!hosts.is_counted() && options.window == 0) {
+        throw std::runtime_error("Hosts read on the go need a window of destinations");
+    }
 
-            res.dest_error.push_back(DestInfo(Address(), ip_or_hostname, false));
+    // Caches would be written with the owner's rights to wherever the caller points them
+    if (runs_setuid() && (!options.ptr_cache_file.empty() || !options.distance_cache_file.empty())) {
+        throw std::runtime_error("A set-user-ID program cannot keep a cache file, run it with CAP_NET_RAW instead");
+    }
+
+    // Probe order is a permutation of all probes, so every destination has to be known
+    if (options.stateless && (!options.stream || options.window > 0)) {
+        throw std::runtime_error("Stateless probing needs streaming and cannot use a window");
+    }
+
+    if (options.stateless && options.doubletree_hop > 0) {
+        throw std::runtime_error("Stateless probing keeps no routes for doubletree to stop on");
+    }
+
+    // Replies are not matched to destinations, there are no distances to estimate or keep
+    if (options.stateless && (options.hop_distance || !options.distance_cache_file.empty())) {
+        throw std::runtime_error("Stateless probing estimates no hop distances, it cannot use them or a distance cache");
+    }
+
+    if (options.stateless && options.waittime > STATELESS_MAX_WAITTIME) {
+        throw std::runtime_error("Stateless probing cannot wait longer than " +
+                                 std::to_string(STATELESS_MAX_WAITTIME) + " ms, round trip times would wrap");
+    }
+
+    // Permutation of a stateless run covers the probes of all destinations of one prober
+    if (options.shards < 1 || options.shards > MAX_SHARDS || (options.stateless && options.shards > 1)) {
+        throw std::runtime_error("Number of shards must be 1 to " + std::to_string(MAX_SHARDS) +
+                                 ", stateless probing needs a single one");
+    }
+
+    /*
+     * Number of destinations of each family is not known until all lookups finish. Indices
+     * of retired destinations are reused, so a window needs only as many.
+     */
+    size_t max_dest = (options.window > 0) ? options.window : hosts.get_count();
+    if (hosts.is_counted()) {
+        max_dest = std::min(max_dest, hosts.get_count());
+    }
+
+    int ttls = options.max_ttl - options.start_ttl + 1;
+
+    // Every shard has a range of tags for all the destinations, any of them may take them over
+    uint64_t shard_tags = uint64_t(max_dest) * ttls * options.probes;
+
+    if (!options.stateless && shard_tags * options.shards >= PROBE_TAGS) {
+        std::ostringstream error;
+        error << "Too many probes: " << max_dest << " hosts with " << ttls << " hops and "
+              << options.probes << " probes per hop exceed 2^32 probes per run";
+        if (options.shards > 1) {
+            error << " (in each of " << options.shards << " shards), use fewer shards";
+        }
+
+        throw std::runtime_error(error.str());
+    }
+
+    /*
+     * Resolving users input addresses into Address structures runs in the background,
+     * probing of a destination starts as soon as its address is known.
+     */
+    DestFeed feed_error;
+    vector<std::unique_ptr<Shard>> shards;
+    vector<DestFeed *> feeds_ip4, feeds_ip6;
+
+    for (int k = 0; k < options.shards; ++k) {
+        shards.emplace_back(new Shard(ttls, options.probes));
+        feeds_ip4.push_back(&shards.back()->feed_ip4);
+        feeds_ip6.push_back(&shards.back()->feed_ip6);
+    }
+
+    /*
+     * Reverse lookups of offenders run concurrently with probing, hostnames known from
+     * previous runs are taken from the cache file.
+     */
+    PtrCache ptr_cache(std::chrono::seconds(options.ptr_cache_ttl));
+    std::unique_ptr<ReverseResolver> reverse;
+
+    if (options.map_ip_to_host) {
+        if (!options.ptr_cache_file.empty()) {
+            ptr_cache.load(options.ptr_cache_file);
         }
+
+        reverse.reset(new ReverseResolver(ptr_cache, options.resolvers));
     }
 
+    // Hop distances of networks traced by previous runs narrow the ttl range of their destinations
+    std::unique_ptr<DistanceCache> distances;
 
-    vector<int> ttl_done,
-                ttl_done_ip4(res.dest_ip4.size(), DEF_TTL_DONE),
-                ttl_done_ip6(res.dest_ip6.size(), DEF_TTL_DONE);
+    if (!options.distance_cache_file.empty()) {
+        distances.reset(new DistanceCache(options.distance_cache_file,
+                                          std::chrono::seconds(options.distance_cache_ttl)));
+    }
+
+    Resolver resolver(hosts, options.af_if_unknown, options.resolvers,
+                      (options.window > 0) ? options.window : Resolver::NO_LIMIT);
 
+    std::thread dispatcher = std::thread(dispatch_resolved,
+                                         std::ref(resolver),
+                                         std::ref(feeds_ip4),
+                                         std::ref(feeds_ip6),
+                                         std::ref(feed_error));
+
+    // Random tag offsets and cookie keys tell our probes from those of other runs
     std::random_device r;
     std::default_random_engine e1(r());
-    std::uniform_int_distribution<int> icmp_seq_dist(0, ICMP_SEQ_ID_MAX - options.probes * options.max_ttl),
-                                       icmp4_id_dist(0, ICMP_SEQ_ID_MAX - res.dest_ip4.size()),
-                                       icmp6_id_dist(0, ICMP_SEQ_ID_MAX - res.dest_ip6.size());
-
-    int icmp4_id_offset = icmp4_id_dist(e1),
-        icmp4_seq_offset = icmp_seq_dist(e1),
-        icmp6_id_offset = icmp6_id_dist(e1),
-        icmp6_seq_offset = icmp_seq_dist(e1);
-
-    if (res.dest_ip4.size() > 0) {
-        send_and_recv(AddressFamily::Inet,
-              res.dest_ip4,
-              ttl_done_ip4,
-              res.probes_info_ip4,
-              icmp4_id_offset,
-              icmp4_seq_offset,
-              options);
-    }
-
-    if (res.dest_ip6.size() > 0) {
-        send_and_recv(AddressFamily::Inet6,
-              res.dest_ip6,
-              ttl_done_ip6,
-              res.probes_info_ip6,
-              icmp6_id_offset,
-              icmp6_seq_offset,
-              options);
+    std::uniform_int_distribution<uint32_t> u32_dist;
+
+    uint32_t offset_ip4 = u32_dist(e1), offset_ip6 = u32_dist(e1);
+
+    for (size_t k = 0; k < shards.size(); ++k) {
+        Shard &shard = *shards[k];
+
+        // Ranges of the shards follow each other, so the filter of a socket passes only its own replies
+        uint32_t shard_offset = static_cast<uint32_t>(k * shard_tags);
+
+        ProbeCodec codec_ip4(offset_ip4 + shard_offset, u32_dist(e1), max_dest, ttls, options.probes),
+                   codec_ip6(offset_ip6 + shard_offset, u32_dist(e1), max_dest, ttls, options.probes);
+
+        shard.prober_ip4.reset(new FamilyProber<Inet4>(shard.feed_ip4, shard.dest_ip4, shard.probes_ip4,
+                                                       reverse.get(), distances.get(), shard.send_stats,
+                                                       shard.recv_stats, codec_ip4, options));
+        shard.prober_ip6.reset(new FamilyProber<Inet6>(shard.feed_ip6, shard.dest_ip6, shard.probes_ip6,
+                                                       reverse.get(), distances.get(), shard.send_stats,
+                                                       shard.recv_stats, codec_ip6, options));
+
+        if (shards.size() > 1) {
+            shard.prober_ip4->set_siblings(siblings(feeds_ip4, k));
+            shard.prober_ip6->set_siblings(siblings(feeds_ip6, k));
+        }
+    }
+
+    std::unique_ptr<NamingSink> naming_sink;
+    if (sink != nullptr && options.map_ip_to_host) {
+        naming_sink.reset(new NamingSink(*sink, ptr_cache));
+        sink = naming_sink.get();
+    }
+
+    std::unique_ptr<WindowSink> window_sink;
+    if (options.window > 0) {
+        window_sink.reset(new WindowSink(*sink, resolver));
+        sink = window_sink.get();
+    }
+
+    std::unique_ptr<LockedSink> locked_sink;
+    if (sink != nullptr && shards.size() > 1) {
+        locked_sink.reset(new LockedSink(*sink));
+        sink = locked_sink.get();
+    }
+
+    try {
+        run_shards(shards, feed_error, res.dest_error, sink, options, cancel);
+    } catch (const std::exception &e) {
+        // Workers waiting for pushed hosts would keep the dispatcher waiting too
+        hosts.close();
+        resolver.stop();
+        dispatcher.join();
+
+        throw std::runtime_error(std::string(e.what()) + "\nTry running the program in a priviledged mode");
     }
 
+    // Everything is resolved by the end of a complete run, a cancelled one skips the rest
+    hosts.close();
+    resolver.stop();
+    dispatcher.join();
+
+    if (distances) {
+        try {
+            distances->save();
+        } catch (const std::exception &e) {
+            std::cerr << "Could not save distance cache: " << e.what() << std::endl;
+        }
+    }
+
+    res.resolver_stats = resolver.get_stats();
+    res.send_stats.requested_rate = probe_rate(options);
+    res.probes_ip4 = ProbeTable(ttls, options.probes);
+    res.probes_ip6 = ProbeTable(ttls, options.probes);
+
+    // Routes of a single shard are taken over as they are
+    for (size_t k = 0; k < shards.size(); ++k) {
+        Shard &shard = *shards[k];
+        merge_stats(shard, res.send_stats, res.recv_stats);
+
+        if (k == 0) {
+            res.dest_ip4 = std::move(shard.dest_ip4);
+            res.dest_ip6 = std::move(shard.dest_ip6);
+            res.probes_ip4 = std::move(shard.probes_ip4);
+            res.probes_ip6 = std::move(shard.probes_ip6);
+        } else if (!options.stream) {
+            res.dest_ip4.insert(res.dest_ip4.end(), shard.dest_ip4.begin(), shard.dest_ip4.end());
+            res.dest_ip6.insert(res.dest_ip6.end(), shard.dest_ip6.begin(), shard.dest_ip6.end());
+            res.probes_ip4.append(shard.probes_ip4);
+            res.probes_ip6.append(shard.probes_ip6);
+        }
+    }
+
+    // Destinations were streamed, what is left are the last users of reused indices
+    if (options.stream) {
+        res.dest_ip4.clear();
+        res.dest_ip6.clear();
+    }
+
+    restore_input_order(res.dest_ip4, res.probes_ip4);
+    restore_input_order(res.dest_ip6, res.probes_ip6);
+    std::sort(res.dest_error.begin(), res.dest_error.end(), [](const DestInfo &a, const DestInfo &b) {
+        return a.input_ind < b.input_ind;
+    });
+
     if (options.map_ip_to_host) {
-        lookup_hostnames(res.probes_info_ip4);
-        lookup_hostnames(res.probes_info_ip6);
+        reverse->finish();
+
+        lookup_hostnames(res.probes_ip4, ptr_cache);
+        lookup_hostnames(res.probes_ip6, ptr_cache);
+
+        if (!options.ptr_cache_file.empty()) {
+            try {
+                ptr_cache.save(options.ptr_cache_file);
+            } catch (const std::exception &e) {
+                std::cerr << "Could not save hostname cache: " << e.what() << std::endl;
+            }
+        }
     }
 
     return res;
-}
\ No newline at end of file
+}
@@ -6,48 +6,238 @@
 #define NET_MULTI_TRACEROUTE_H
 
 #include "net/Address.h"
+#include "net/Resolver.h"
+#include "net/HostSource.h"
 #include "net/enums.h"
+#include "ProbeTable.h"
 
 #include <vector>
+#include <string>
 #include <chrono>
 
+class Notifier;
+
+// More shards would not find a core of their own on any machine the tool runs on
+constexpr int MAX_SHARDS = 64;
+
+// Stateless probes carry their send time in 24 bits of microseconds, which wrap after ~16.7 s
+constexpr int STATELESS_MAX_WAITTIME = 16777;
+
 struct TraceOptions {
     AddressFamily af_if_unknown;
     int probes;
     int sendwait;
+
+    // Probes per second and pacer's bucket size, rate 0 means sendwait is used instead
+    double rate;
+    int burst;
     int waittime;
     int start_ttl;
     int max_ttl;
     bool map_ip_to_host;
+
+    // Maximum number of concurrent forward DNS lookups
+    int resolvers;
+    bool show_stats;
+
+    // File with hostnames of previously seen IPs (empty to disable) and their lifetime in seconds
+    std::string ptr_cache_file;
+    int ptr_cache_ttl;
+
+    /*
+     * Hand every destination to a RouteSink as soon as it is finished and release its
+     * probes. Routes are printed in input order if stream_input_order is set, holding
+     * at most reorder_buffer finished routes back.
+     */
+    bool stream;
+    bool stream_input_order;
+    int reorder_buffer;
+
+    // Maximum number of destinations in flight (resolving, probing or waiting for replies), 0 for no limit
+    int window;
+
+    /*
+     * Keep no state per probe: walk all (destination, ttl, probe) triples in a keyed
+     * random order and hand every reply to RouteSink::reply_decoded as it arrives,
+     * rebuilt from the reply alone. Needs streaming and a counted source. Round trip times
+     * are kept mod 2^24 us, so waittime may be at most STATELESS_MAX_WAITTIME ms.
+     */
+    bool stateless;
+
+    /*
+     * Doubletree: probe every destination forward from this ttl and then backward towards
+     * start_ttl, leaving out hops known from other routes (see FamilyProber). 0 to disable.
+     */
+    int doubletree_hop;
+
+    /*
+     * Stop probing a destination forward after this many consecutive hops without a reply,
+     * a hop is given up waittime milliseconds after its last probe. 0 to disable.
+     */
+    int gap_limit;
+
+    /*
+     * Wait for the replies of every destination as long as its round trip times suggest
+     * (RFC 6298, SRTT + 4 * RTTVAR), but at least min_waittime and at most waittime
+     * milliseconds. 0 to wait waittime for every destination.
+     */
+    int min_waittime;
+
+    /*
+     * Send a single probe with max_ttl to every destination first and estimate its hop
+     * distance from the TTL of the Echo Reply. Forward probing then stops a few hops past
+     * the distance, with descending it also starts at the distance and goes backward
+     * towards start_ttl afterwards (like doubletree). Destinations with no Echo Reply are
+     * probed as usual.
+     */
+    bool hop_distance;
+    bool descending;
+
+    /*
+     * File with hop distances of destination networks (empty to disable) and their lifetime
+     * in seconds. Destinations in a known network are probed in a range around the distance
+     * found by an earlier run, without the distance probe.
+     */
+    std::string distance_cache_file;
+    int distance_cache_ttl;
+
+    /*
+     * Send and receive through a PacketRing (AF_PACKET rings mapped into memory) instead of
+     * a raw socket. Only destinations routed like the first of their family take the ring,
+     * the others are probed through a raw socket. Raw sockets are used if it cannot be set up.
+     */
+    bool packet_ring;
+
+    /*
+     * Send and receive through io_uring (UringSocket) instead of sendmmsg and recvmmsg, a raw
+     * socket is used if the kernel cannot do it.
+     */
+    bool io_uring;
+
+    /*
+     * Number of shards the destinations are split into, each with its own probers, sockets
+     * and event loop thread pinned to a core, see run_shards in multi_traceroute.cpp. 1 to
+     * MAX_SHARDS, stateless probing needs a single one.
+     */
+    int shards;
 };
 
+/* Options of the command line tool without any flag, the hostname cache file included */
+TraceOptions default_trace_options();
+
 /* Structure holds information about single destination that should be tracerouted. */
 struct DestInfo {
     DestInfo() {
         address = Address();
     }
-    DestInfo(Address address, std::string dest_str, bool valid) :
-        address(address), dest_str(dest_str), address_valid(valid) { }
+    DestInfo(Address address, std::string dest_str, bool valid, size_t input_ind) :
+        address(address), dest_str(dest_str), address_valid(valid), input_ind(input_ind) { }
 
     Address address;
 
     // Original string from user
     std::string dest_str;
     bool address_valid;
+
+    // Position of dest_str in the user's input
+    size_t input_ind = 0;
 };
 
-struct ProbeInfo {
+struct SendStats {
+    size_t probes_sent = 0;
+
+    // Probes left out by doubletree because their hops were known from other routes
+    size_t probes_skipped = 0;
+
+    // Probes left out because the route went silent for gap_limit hops
+    size_t probes_truncated = 0;
+
+    // Destinations whose hop distance was estimated (some of them taken from the cache)
+    // and probes left out past it
+    size_t distances_estimated = 0;
+    size_t distances_cached = 0;
+    size_t probes_out_of_range = 0;
+
+    // Destinations farther than their estimate, probed up to max_ttl after all
+    size_t ranges_extended = 0;
+
+    // Destinations a shard took over from another one which was behind
+    size_t dests_stolen = 0;
+
+    // Requested probes per second, 0 if the rate was not limited
+    double requested_rate = 0;
+    std::chrono::microseconds duration = std::chrono::microseconds(0);
+
+    // Time from the last probe to the end of the run, spent waiting for replies
+    std::chrono::microseconds tail = std::chrono::microseconds(0);
+};
+
+struct RecvStats {
+    // All ICMP packets read from the sockets and those that matched one of our probes
+    size_t packets_received = 0;
+    size_t probes_matched = 0;
+
+    // Replies to echo requests which are not ours, or whose cookie did not match
+    size_t replies_rejected = 0;
+
+    // Number of recvmmsg calls (reads of a PacketRing) that returned at least one packet
+    // and the largest batch
+    size_t recv_calls = 0;
+    size_t max_batch = 0;
+};
+
+/* A reply of stateless probing (TraceOptions::stateless), everything is taken from the reply itself */
+struct DecodedReply {
+    Address target;
+    int ttl;
     Address offender;
     IcmpRespStatus icmp_status;
-    std::chrono::steady_clock::time_point send_time, recv_time;
-    bool did_arrive = false;
+    u_int32_t rtt_us;
 };
 
 struct TraceResult {
     std::vector<DestInfo> dest_ip4, dest_ip6, dest_error;
-    std::vector<std::vector<std::vector<ProbeInfo>>> probes_info_ip4, probes_info_ip6;
+    ProbeTable probes_ip4, probes_ip6;
+
+    ResolverStats resolver_stats;
+    SendStats send_stats;
+    RecvStats recv_stats;
+};
+
+/*
+ * Interface of a receiver of streamed routes (TraceOptions::stream). A destination is
+ * finished once all of its probes are answered or timed out (waittime milliseconds after
+ * the last one, or less with min_waittime); its probes are released right after
+ * route_done returns. Methods are called from the thread which runs
+ * multi_traceroute, or with several shards from their threads, one call at a time.
+ */
+class RouteSink {
+public:
+    /* Probes of dest are in probes at probes.slot(dest_ind, ttl_ind, p), hops have hostnames */
+    virtual void route_done(const DestInfo &dest, ProbeTable &probes, size_t dest_ind) = 0;
+
+    /* Lookup of dest failed, it is not traced */
+    virtual void route_failed(const DestInfo &dest) = 0;
+
+    /* Stateless probing reports replies instead of routes, offender has its hostname */
+    virtual void reply_decoded(const DecodedReply &) { }
+
+    virtual ~RouteSink() { }
 };
 
-TraceResult multi_traceroute(std::vector<std::string> dest, TraceOptions options);
+/*
+ * Function traceroutes all destinations of hosts. If options.stream is set, the routes
+ * (and failed lookups) are handed to sink as they finish and forgotten, so the result
+ * holds no routes afterwards. With options.window only that many hosts are taken from
+ * hosts at once, a new one whenever another finishes; a source which is not counted
+ * (pushed hosts) needs a window and streaming. A source which is pushed to is closed
+ * once the run ends, fails or is cancelled, so that its pusher is not waited for.
+ *
+ * Once cancel becomes readable (it is never consumed), probing stops: destinations not
+ * finished yet are dropped and so are hosts not resolved yet. Throws std::runtime_error
+ * if the options do not go together or probing fails.
+ */
+TraceResult multi_traceroute(HostSource &hosts, TraceOptions options, RouteSink *sink = nullptr,
+                             const Notifier *cancel = nullptr);
 
 #endif // NET_MULTI_TRACEROUTE_H
\ No newline at end of file
@@ -0,0 +1,250 @@
+#include "DistanceCache.h"
+#include "utility.h"
+#include "Hash.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <system_error>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr char CACHE_MAGIC[4] = {'M', 'R', 'D', 'C'};
+constexpr u_int32_t CACHE_VERSION = 1;
+
+// Entries of a new file, 16 KiB
+constexpr u_int32_t MIN_CAPACITY = 1024;
+
+// Entries of the largest file, 256 MiB (every /24 of IPv4 fits in at half the load)
+constexpr u_int32_t MAX_CAPACITY = u_int32_t(1) << 24;
+
+constexpr size_t DistanceCache::MAX_PREFIX_LEN;
+
+/* FNV-1a hash of the prefix length (a single byte, it is at most MAX_PREFIX_LEN) and the prefix */
+static u_int32_t prefix_hash(const u_int8_t *prefix, size_t length) {
+    u_int8_t length_byte = static_cast<u_int8_t>(length);
+    return fnv1a(prefix, length, fnv1a(&length_byte, 1));
+}
+
+DistanceCache::DistanceCache(const std::string &path, std::chrono::seconds ttl) : path_(path), ttl_(ttl) {
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    Header header;
+
+    if (read_header_(fd, header)) {
+        void *map = mmap(nullptr, file_size_(header.capacity), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (map != MAP_FAILED) {
+            map_ = static_cast<const char *>(map);
+            map_size_ = file_size_(header.capacity);
+            capacity_ = header.capacity;
+        }
+    }
+
+    close(fd);
+}
+
+DistanceCache::~DistanceCache() {
+    if (map_ != nullptr) {
+        munmap(const_cast<char *>(map_), map_size_);
+    }
+}
+
+size_t DistanceCache::file_size_(u_int32_t capacity) {
+    return sizeof (Header) + static_cast<size_t>(capacity) * sizeof (Entry);
+}
+
+/* Method reads the header of the file, false if it is not a valid cache */
+bool DistanceCache::read_header_(int fd, Header &header) {
+    struct stat info;
+
+    return fstat(fd, &info) == 0 && pread(fd, &header, sizeof (header), 0) == sizeof (header) &&
+           memcmp(header.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC)) == 0 && header.version == CACHE_VERSION &&
+           header.capacity > 0 && header.capacity <= MAX_CAPACITY &&
+           (header.capacity & (header.capacity - 1)) == 0 && header.count <= header.capacity &&
+           static_cast<size_t>(info.st_size) == file_size_(header.capacity);
+}
+
+const DistanceCache::Entry *DistanceCache::find_(const Entry *table, u_int32_t capacity,
+                                                 const u_int8_t *prefix, size_t length)
+{
+    u_int32_t mask = capacity - 1;
+    u_int32_t i = prefix_hash(prefix, length) & mask;
+
+    // A file which is full (or claims to be less full than it is) must not make the probe spin
+    for (u_int32_t step = 0; step < capacity && table[i].prefix_len != 0; ++step, i = (i + 1) & mask) {
+        if (table[i].prefix_len == length && memcmp(table[i].prefix, prefix, length) == 0) {
+            return &table[i];
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Method stores entry in place of the one with the same prefix or in a free slot. The
+ * entry is dropped if there is neither, which only a table that lies about its count has.
+ */
+void DistanceCache::insert_(Entry *table, u_int32_t capacity, const Entry &entry, bool &added) {
+    u_int32_t mask = capacity - 1;
+    u_int32_t i = prefix_hash(entry.prefix, entry.prefix_len) & mask;
+
+    for (u_int32_t step = 0; step < capacity; ++step, i = (i + 1) & mask) {
+        if (table[i].prefix_len == 0 ||
+            (table[i].prefix_len == entry.prefix_len && memcmp(table[i].prefix, entry.prefix, entry.prefix_len) == 0)) {
+            added = table[i].prefix_len == 0;
+            table[i] = entry;
+            return;
+        }
+    }
+
+    added = false;
+}
+
+bool DistanceCache::is_fresh_(const Entry &entry, std::time_t now) const {
+    return static_cast<std::time_t>(entry.stored) + static_cast<std::time_t>(ttl_.count()) > now;
+}
+
+bool DistanceCache::get(const char *prefix, size_t length, int &distance) const {
+    if (map_ == nullptr || length == 0 || length > MAX_PREFIX_LEN) {
+        return false;
+    }
+
+    const Entry *table = reinterpret_cast<const Entry *>(map_ + sizeof (Header));
+    const Entry *entry = find_(table, capacity_, reinterpret_cast<const u_int8_t *>(prefix), length);
+
+    if (entry == nullptr || !entry->reached || !is_fresh_(*entry, std::time(nullptr))) {
+        return false;
+    }
+
+    distance = entry->distance;
+    return true;
+}
+
+void DistanceCache::put(const char *prefix, size_t length, int distance, bool reached) {
+    if (length == 0 || length > MAX_PREFIX_LEN) {
+        return;
+    }
+
+    Entry entry = Entry();
+    entry.prefix_len = static_cast<u_int8_t>(length);
+    memcpy(entry.prefix, prefix, length);
+    entry.distance = static_cast<u_int8_t>(std::min(std::max(distance, 0), 255));
+    entry.reached = reached;
+    entry.stored = static_cast<u_int32_t>(std::time(nullptr));
+
+    std::lock_guard<std::mutex> lock(puts_mutex_);
+    puts_.push_back(entry);
+}
+
+void DistanceCache::save() {
+    if (puts_.empty()) {
+        return;
+    }
+
+    make_parent_dirs(path_);
+
+    // A symlink planted in place of the cache would redirect the write
+    int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), path_);
+    }
+
+    // Lock is released when fd is closed
+    if (flock(fd, LOCK_EX) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path_);
+    }
+
+    // Hosts of one network put it several times, the last put wins
+    std::reverse(puts_.begin(), puts_.end());
+    std::stable_sort(puts_.begin(), puts_.end(), [](const Entry &a, const Entry &b) {
+        return std::lexicographical_compare(a.prefix, a.prefix + a.prefix_len, b.prefix, b.prefix + b.prefix_len);
+    });
+    puts_.erase(std::unique(puts_.begin(), puts_.end(), [](const Entry &a, const Entry &b) {
+        return a.prefix_len == b.prefix_len && memcmp(a.prefix, b.prefix, a.prefix_len) == 0;
+    }), puts_.end());
+
+    Header header;
+    bool valid = read_header_(fd, header);
+
+    u_int32_t capacity = valid ? header.capacity : 0;
+    u_int32_t count = valid ? header.count : 0;
+
+    // Keep the table at most half full, entries beyond the largest table are not saved
+    size_t new_capacity = std::max(capacity, MIN_CAPACITY);
+    while ((count + puts_.size()) * 2 > new_capacity && new_capacity < MAX_CAPACITY) {
+        new_capacity *= 2;
+    }
+
+    std::time_t now = std::time(nullptr);
+    std::vector<Entry> kept;
+
+    // Growing rehashes the entries which did not expire, the file is extended with zeros
+    if (new_capacity != capacity) {
+        if (valid) {
+            kept.resize(capacity);
+
+            if (pread(fd, kept.data(), capacity * sizeof (Entry), sizeof (Header)) !=
+                static_cast<ssize_t>(capacity * sizeof (Entry))) {
+                kept.clear();
+            }
+
+            kept.erase(std::remove_if(kept.begin(), kept.end(), [this, now](const Entry &entry) {
+                return entry.prefix_len == 0 || !is_fresh_(entry, now);
+            }), kept.end());
+        }
+
+        if (ftruncate(fd, file_size_(new_capacity)) == -1) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), path_);
+        }
+
+        count = 0;
+    }
+
+    void *map = mmap(nullptr, file_size_(new_capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path_);
+    }
+
+    Header *file_header = static_cast<Header *>(map);
+    Entry *table = reinterpret_cast<Entry *>(static_cast<char *>(map) + sizeof (Header));
+
+    if (new_capacity != capacity) {
+        memset(table, 0, new_capacity * sizeof (Entry));
+    }
+
+    for (const std::vector<Entry> *entries : {&kept, &puts_}) {
+        for (const Entry &entry : *entries) {
+            bool added = false;
+            insert_(table, new_capacity, entry, added);
+            count += added;
+        }
+    }
+
+    memcpy(file_header->magic, CACHE_MAGIC, sizeof (CACHE_MAGIC));
+    file_header->version = CACHE_VERSION;
+    file_header->capacity = new_capacity;
+    file_header->count = count;
+
+    munmap(map, file_size_(new_capacity));
+    close(fd);
+
+    puts_.clear();
+}
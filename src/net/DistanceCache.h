@@ -0,0 +1,87 @@
+#ifndef NET_DISTANCE_CACHE_H
+#define NET_DISTANCE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+
+/*
+ * Class DistanceCache maps destination networks (the first bytes of an address, /24 for
+ * IPv4 and /48 for IPv6) to the hop distance seen by the last run which traced one of
+ * their addresses, and whether the destination was reached there.
+ *
+ * The file is an open addressing hash table of fixed size entries mapped into memory, so
+ * a lookup reads a page or two instead of loading the whole cache. Entries put during a
+ * run are written into the file by save() under an exclusive lock (flock), the table is
+ * grown in place when it gets half full. Entries expire ttl seconds after they were stored.
+ * A run which looks up entries while another one saves may miss some of them. get and put
+ * may be called from several threads at once, save only when nothing else runs.
+ */
+class DistanceCache {
+public:
+    /* A missing or malformed file (or a symlink) is not an error, the cache is empty then */
+    DistanceCache(const std::string &path, std::chrono::seconds ttl);
+    ~DistanceCache();
+
+    DistanceCache(const DistanceCache &) = delete;
+    DistanceCache &operator=(const DistanceCache &) = delete;
+
+    /*
+     * Method returns true and fills distance if the network has an entry that did not
+     * expire and whose destination was reached.
+     */
+    bool get(const char *prefix, size_t length, int &distance) const;
+
+    /* Method stores the distance of a network, the last hop which answered if it was not reached */
+    void put(const char *prefix, size_t length, int distance, bool reached);
+
+    /*
+     * Method writes the entries put since the cache was opened, missing directories are
+     * created. Throws std::system_error if the file is a symlink.
+     */
+    void save();
+
+private:
+    static constexpr size_t MAX_PREFIX_LEN = 6;
+
+    struct Header {
+        char magic[4];
+        u_int32_t version;
+        u_int32_t capacity;
+        u_int32_t count;
+    };
+
+    // Entry with prefix_len 0 is free
+    struct Entry {
+        u_int8_t prefix_len;
+        u_int8_t prefix[MAX_PREFIX_LEN];
+        u_int8_t distance;
+        u_int8_t reached;
+        u_int8_t unused[3];
+        u_int32_t stored;
+    };
+
+    std::string path_;
+    std::chrono::seconds ttl_;
+
+    // Mapped file opened for lookups, nullptr if there is none
+    const char *map_ = nullptr;
+    size_t map_size_ = 0;
+    u_int32_t capacity_ = 0;
+
+    std::mutex puts_mutex_;
+    std::vector<Entry> puts_;
+
+    static size_t file_size_(u_int32_t capacity);
+    static bool read_header_(int fd, Header &header);
+    static const Entry *find_(const Entry *table, u_int32_t capacity, const u_int8_t *prefix, size_t length);
+    static void insert_(Entry *table, u_int32_t capacity, const Entry &entry, bool &added);
+
+    bool is_fresh_(const Entry &entry, std::time_t now) const;
+};
+
+#endif // NET_DISTANCE_CACHE_H
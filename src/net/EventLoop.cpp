@@ -0,0 +1,164 @@
+#include "EventLoop.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Maximum number of events returned by a single epoll_wait
+constexpr int MAX_EVENTS = 16;
+
+/*
+ * EventLoop
+ */
+
+EventLoop::EventLoop() : events_(MAX_EVENTS) {
+    epoll_FD_ = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll_FD_ == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+EventLoop::~EventLoop() {
+    close(epoll_FD_);
+}
+
+void EventLoop::add(int fd, int token) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(token);
+
+    if (epoll_ctl(epoll_FD_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void EventLoop::remove(int fd) {
+    if (epoll_ctl(epoll_FD_, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void EventLoop::wait(std::vector<int> &tokens, int timeout_ms) {
+    tokens.clear();
+
+    int n_events = epoll_wait(epoll_FD_, events_.data(), events_.size(), timeout_ms);
+
+    if (n_events == -1) {
+        // A signal is not an error, the caller simply gets no events
+        if (errno == EINTR) {
+            return;
+        }
+
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    for (int i = 0; i < n_events; ++i) {
+        tokens.push_back(static_cast<int>(events_[i].data.u32));
+    }
+}
+
+/*
+ * Timer
+ */
+
+Timer::Timer() {
+    timer_FD_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (timer_FD_ == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+Timer::~Timer() {
+    close(timer_FD_);
+}
+
+int Timer::get_fd() const {
+    return timer_FD_;
+}
+
+void Timer::set(std::chrono::steady_clock::time_point at) {
+    auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = since_epoch / 1000000000;
+    spec.it_value.tv_nsec = since_epoch % 1000000000;
+
+    // All zeros would disarm the timer
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+
+    if (timerfd_settime(timer_FD_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    armed_ = true;
+}
+
+void Timer::disarm() {
+    struct itimerspec spec = {};
+
+    if (timerfd_settime(timer_FD_, 0, &spec, nullptr) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    armed_ = false;
+}
+
+bool Timer::is_armed() const {
+    return armed_;
+}
+
+void Timer::consume() {
+    uint64_t expirations;
+
+    // Nothing to read (EAGAIN) is fine, the timer was rearmed or disarmed meanwhile
+    if (read(timer_FD_, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    armed_ = false;
+}
+
+/*
+ * Notifier
+ */
+
+Notifier::Notifier() {
+    event_FD_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (event_FD_ == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+Notifier::~Notifier() {
+    close(event_FD_);
+}
+
+int Notifier::get_fd() const {
+    return event_FD_;
+}
+
+void Notifier::notify() {
+    uint64_t one = 1;
+
+    if (write(event_FD_, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void Notifier::consume() {
+    uint64_t count;
+
+    if (read(event_FD_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef NET_EVENT_LOOP_H
+#define NET_EVENT_LOOP_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <sys/epoll.h>
+
+/*
+ * Class EventLoop is a thin wrapper over epoll. Every watched file descriptor is
+ * registered with a token that is returned by wait() once the descriptor is readable.
+ */
+class EventLoop {
+public:
+    EventLoop();
+
+    /* Watch fd for readability (level-triggered) */
+    void add(int fd, int token);
+    void remove(int fd);
+
+    /*
+     * Method waits at most timeout_ms milliseconds (-1 means forever) and fills
+     * tokens with those of readable descriptors.
+     */
+    void wait(std::vector<int> &tokens, int timeout_ms);
+
+    ~EventLoop();
+private:
+    int epoll_FD_ = -1;
+    std::vector<struct epoll_event> events_;
+};
+
+/*
+ * Class Timer is a one-shot timerfd on CLOCK_MONOTONIC (the clock behind
+ * std::chrono::steady_clock on Linux). Its descriptor becomes readable when it expires.
+ */
+class Timer {
+public:
+    Timer();
+
+    int get_fd() const;
+
+    /* Arm the timer to expire at the given time, rearming replaces the previous time */
+    void set(std::chrono::steady_clock::time_point at);
+    void disarm();
+    bool is_armed() const;
+
+    /* Method clears the expiration so that the descriptor is not readable anymore */
+    void consume();
+
+    ~Timer();
+private:
+    int timer_FD_ = -1;
+    bool armed_ = false;
+};
+
+/*
+ * Class Notifier is an eventfd other threads use to wake up an EventLoop.
+ */
+class Notifier {
+public:
+    Notifier();
+
+    int get_fd() const;
+
+    /* Can be called from any thread */
+    void notify();
+    void consume();
+
+    ~Notifier();
+private:
+    int event_FD_ = -1;
+};
+
+#endif // NET_EVENT_LOOP_H
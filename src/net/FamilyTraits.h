@@ -0,0 +1,151 @@
+#ifndef NET_FAMILY_TRAITS_H
+#define NET_FAMILY_TRAITS_H
+
+#include "enums.h"
+#include "Address.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <linux/if_ether.h>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/*
+ * Structs Inet4 and Inet6 describe everything the probing engine does differently for
+ * ICMPv4 and ICMPv6. They are used as template arguments (FamilyProber, ProbeTemplate,
+ * IcmpReplyView), so the differences are resolved at compile time.
+ */
+struct Inet4 {
+    static constexpr AddressFamily family = AddressFamily::Inet;
+    static constexpr Protocol protocol = Protocol::ICMP;
+
+    static constexpr u_int8_t echo_request_type = ICMP_ECHO;
+
+    // ICMPv4 checksum is filled in by us, the kernel computes it only for ICMPv6
+    static constexpr bool user_checksum = true;
+
+    // Raw IPv4 sockets return the IP header in front of the ICMP message
+    static constexpr bool recv_ip_hdr = true;
+
+    static constexpr size_t min_ip_hdr_len = 20;
+
+    // Length of an IP address and offset of the destination address in the IP header
+    static constexpr size_t addr_len = 4;
+    static constexpr size_t dst_addr_offset = 16;
+
+    // IP header fields read by PacketRing, which gets whole packets
+    static constexpr u_int16_t ether_type = ETH_P_IP;
+    static constexpr size_t src_addr_offset = 12;
+    static constexpr size_t hop_limit_offset = 8;
+    static constexpr size_t next_header_offset = 9;
+
+    // Bytes of the address which make up the destination's network (/24) for stop sets
+    static constexpr size_t net_prefix_len = 3;
+
+    static size_t ip_hdr_len(const char *ip_hdr) {
+        return (static_cast<u_int8_t>(ip_hdr[0]) & 0x0f) << 2;
+    }
+
+    /* Raw bytes of the IP address stored in sa */
+    static const char *addr_ptr(const sockaddr *sa) {
+        return reinterpret_cast<const char *>(&reinterpret_cast<const sockaddr_in *>(sa)->sin_addr);
+    }
+
+    static Address make_address(const char *addr) {
+        sockaddr_in sa = {};
+        sa.sin_family = AF_INET;
+        memcpy(&sa.sin_addr, addr, addr_len);
+
+        return Address(reinterpret_cast<const sockaddr *>(&sa), sizeof (sa));
+    }
+
+    /* IcmpRespStatus::Unknown means the message is of no use for traceroute */
+    static IcmpRespStatus resp_status(u_int8_t type, u_int8_t code) {
+        switch (Icmp4Type(type)) {
+            case Icmp4Type::DstUnreach:
+                switch (Icmp4Code(code)) {
+                    case Icmp4Code::Net: return IcmpRespStatus::NetworkUnreachable;
+                    case Icmp4Code::Host: return IcmpRespStatus::HostUnreachable;
+                    case Icmp4Code::Protocol: return IcmpRespStatus::ProtocolUnreachable;
+                    case Icmp4Code::Port: return IcmpRespStatus::PortUnreachable;
+
+                    case Icmp4Code::NetProhib:
+                    case Icmp4Code::HostProhib:
+                    case Icmp4Code::FilterProhib: return IcmpRespStatus::AdminProhibited;
+                    default:  return IcmpRespStatus::Unknown;
+                }
+            case Icmp4Type::TimeExceeded: return IcmpRespStatus::TimeExceeded;
+            case Icmp4Type::EchoReply: return IcmpRespStatus::EchoReply;
+            default: return IcmpRespStatus::Unknown;
+        }
+    }
+};
+
+struct Inet6 {
+    static constexpr AddressFamily family = AddressFamily::Inet6;
+    static constexpr Protocol protocol = Protocol::ICMPv6;
+
+    static constexpr u_int8_t echo_request_type = ICMP6_ECHO_REQUEST;
+
+    static constexpr bool user_checksum = false;
+
+    // Raw IPv6 sockets return the ICMPv6 message only
+    static constexpr bool recv_ip_hdr = false;
+
+    // IPv6 headers are fixed length
+    static constexpr size_t min_ip_hdr_len = 40;
+
+    static constexpr size_t addr_len = 16;
+    static constexpr size_t dst_addr_offset = 24;
+
+    static constexpr u_int16_t ether_type = ETH_P_IPV6;
+    static constexpr size_t src_addr_offset = 8;
+    static constexpr size_t hop_limit_offset = 7;
+    static constexpr size_t next_header_offset = 6;
+
+    // A /48 site
+    static constexpr size_t net_prefix_len = 6;
+
+    static size_t ip_hdr_len(const char *) {
+        return min_ip_hdr_len;
+    }
+
+    static const char *addr_ptr(const sockaddr *sa) {
+        return reinterpret_cast<const char *>(&reinterpret_cast<const sockaddr_in6 *>(sa)->sin6_addr);
+    }
+
+    static Address make_address(const char *addr) {
+        sockaddr_in6 sa = {};
+        sa.sin6_family = AF_INET6;
+        memcpy(&sa.sin6_addr, addr, addr_len);
+
+        return Address(reinterpret_cast<const sockaddr *>(&sa), sizeof (sa));
+    }
+
+    static IcmpRespStatus resp_status(u_int8_t type, u_int8_t code) {
+        switch (Icmp6Type(type)) {
+            case Icmp6Type::DstUnreach:
+                switch (Icmp6Code(code)) {
+                    case Icmp6Code::NoRoute: return IcmpRespStatus::NetworkUnreachable;
+                    case Icmp6Code::Addr: return IcmpRespStatus::HostUnreachable;
+                    case Icmp6Code::NoPort: return IcmpRespStatus::PortUnreachable;
+
+                    case Icmp6Code::Admin: return IcmpRespStatus::AdminProhibited;
+                    default: return IcmpRespStatus::Unknown;
+                }
+            case Icmp6Type::ParamProb:
+                switch (Icmp6Code(code)) {
+                    case Icmp6Code::NextHeader: return IcmpRespStatus::ProtocolUnreachable;
+                    default: return IcmpRespStatus::Unknown;
+                }
+            case Icmp6Type::TimeExceeded: return IcmpRespStatus::TimeExceeded;
+            case Icmp6Type::EchoReply: return IcmpRespStatus::EchoReply;
+            default: return IcmpRespStatus::Unknown;
+        }
+    }
+};
+
+#endif // NET_FAMILY_TRAITS_H
@@ -0,0 +1,35 @@
+#ifndef NET_HASH_H
+#define NET_HASH_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Function is an integer hash with good avalanche (lowbias32 by Chris Wellons): every
+ * input bit flips about half of the output bits. Cookies and permutation rounds use it.
+ */
+inline u_int32_t mix32(u_int32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+constexpr u_int32_t FNV1A_BASIS = 2166136261u;
+constexpr u_int32_t FNV1A_PRIME = 16777619u;
+
+/* FNV-1a hash of length bytes at data, hash continues an earlier one over other bytes */
+inline u_int32_t fnv1a(const void *data, size_t length, u_int32_t hash = FNV1A_BASIS) {
+    const u_int8_t *bytes = static_cast<const u_int8_t *>(data);
+
+    for (size_t k = 0; k < length; ++k) {
+        hash = (hash ^ bytes[k]) * FNV1A_PRIME;
+    }
+
+    return hash;
+}
+
+#endif // NET_HASH_H
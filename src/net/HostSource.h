@@ -0,0 +1,101 @@
+#ifndef NET_HOST_SOURCE_H
+#define NET_HOST_SOURCE_H
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <cstddef>
+
+/*
+ * Class HostSource hands out hosts to trace one at a time. Hosts come either from
+ * a vector (operands) or are pushed by another thread (a source made by the default
+ * constructor), e.g. one reading a stream, which may be of any length then. A pushed
+ * source holds at most max_queued hosts, push blocks while it is full, so a long list
+ * does not have to be held in memory. Methods are not thread-safe, except for next,
+ * push and close.
+ */
+class HostSource {
+public:
+    static constexpr size_t NO_LIMIT = static_cast<size_t>(-1);
+
+    explicit HostSource(std::vector<std::string> hosts) : hosts_(std::move(hosts)) { }
+    explicit HostSource(size_t max_queued = NO_LIMIT) : pushed_(true), max_queued_(max_queued) { }
+
+    /* Method stores the next host in host, returns false once there are no more */
+    bool next(std::string &host) {
+        // Pushed hosts are waited for like a stream which has not been written yet
+        if (pushed_) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this]() { return !queue_.empty() || closed_; });
+
+            if (queue_.empty()) {
+                return false;
+            }
+
+            host = std::move(queue_.front());
+            queue_.pop_front();
+            changed_.notify_all();
+            return true;
+        }
+
+        if (next_ == hosts_.size()) {
+            return false;
+        }
+
+        host = std::move(hosts_[next_++]);
+        return true;
+    }
+
+    /*
+     * Method adds a host to a pushed source, waiting while it is full. Returns false if the
+     * source is closed, the host is dropped then.
+     */
+    bool push(std::string host) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]() { return closed_ || queue_.size() < max_queued_; });
+
+        if (closed_) {
+            return false;
+        }
+
+        queue_.push_back(std::move(host));
+        changed_.notify_all();
+        return true;
+    }
+
+    /*
+     * Method ends the source: next hands out what is queued and then returns false, pushes
+     * fail. Closing ends a run which failed or was cancelled without waiting for the pusher.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        changed_.notify_all();
+    }
+
+    /* True if the number of hosts is known up front */
+    bool is_counted() const {
+        return !pushed_;
+    }
+
+    /* Number of hosts of a counted source */
+    size_t get_count() const {
+        return hosts_.size();
+    }
+
+private:
+    std::vector<std::string> hosts_;
+    size_t next_ = 0;
+
+    bool pushed_ = false;
+    size_t max_queued_ = NO_LIMIT;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::string> queue_;
+    bool closed_ = false;
+};
+
+#endif // NET_HOST_SOURCE_H
@@ -0,0 +1,131 @@
+#include "IcmpFilter.h"
+#include "enums.h"
+
+#include <linux/filter.h>
+#include <stdexcept>
+#include <cstdint>
+#include <vector>
+
+// Length of the IPv6 header quoted in ICMPv6 errors
+constexpr u_int32_t IP6_HDR_LEN = 40;
+
+// Offsets of the protocol (next header) field in the IPv4 and IPv6 header
+constexpr u_int32_t IP4_PROTOCOL_OFFSET = 9;
+constexpr u_int32_t IP6_NEXT_HEADER_OFFSET = 6;
+
+// Offset of the ID and SEQ fields (read as one 32 bit tag) in an ICMP echo header
+constexpr u_int32_t ICMP_TAG_OFFSET = 4;
+
+// Length of ICMP error header preceding the quoted packet
+constexpr u_int32_t ICMP_ERR_HDR_LEN = 8;
+
+// Accept the whole packet
+constexpr u_int32_t BPF_ACCEPT = 0xffffffff;
+
+std::vector<u_int8_t> reply_icmp_types(AddressFamily af) {
+    switch (af) {
+        case AddressFamily::Inet:
+            return {
+                static_cast<u_int8_t>(Icmp4Type::EchoReply),
+                static_cast<u_int8_t>(Icmp4Type::DstUnreach),
+                static_cast<u_int8_t>(Icmp4Type::TimeExceeded),
+            };
+        case AddressFamily::Inet6:
+            return {
+                static_cast<u_int8_t>(Icmp6Type::EchoReply),
+                static_cast<u_int8_t>(Icmp6Type::DstUnreach),
+                static_cast<u_int8_t>(Icmp6Type::TimeExceeded),
+                static_cast<u_int8_t>(Icmp6Type::ParamProb),
+            };
+        default:
+            throw std::runtime_error("Unhandled family in reply_icmp_types");
+    }
+}
+
+/* Function prepends a check of the IP protocol, other packets go to the last instruction (drop) */
+static std::vector<struct sock_filter> check_protocol(std::vector<struct sock_filter> program,
+                                                      u_int32_t protocol_offset, u_int8_t protocol)
+{
+    u_int8_t to_drop = program.size() - 1;
+
+    program.insert(program.begin(), {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, protocol_offset),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, protocol, 0, to_drop),
+    });
+
+    return program;
+}
+
+std::vector<struct sock_filter> make_reply_filter(AddressFamily af, u_int32_t tag_offset, u_int32_t tag_count,
+                                                  bool packet_socket)
+{
+    // Offset of the ICMPv6 header, packet sockets see the IPv6 header in front of it
+    u_int32_t icmp6_off = packet_socket ? IP6_HDR_LEN : 0;
+
+    std::vector<struct sock_filter> program;
+
+    switch (af) {
+        case AddressFamily::Inet:
+            /*
+             * X holds the offset of the ICMP header (outer IP header length). For errors
+             * the tag is at X + 8 (ICMP error) + inner IP header length + 4.
+             * Fragments other than the first one carry no ICMP header and are dropped.
+             */
+            program = {
+                /*  0 */ BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+                /*  1 */ BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 16, 0),
+                /*  2 */ BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+                /*  3 */ BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+                /*  4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp4Type::EchoReply), 2, 0),
+                /*  5 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp4Type::DstUnreach), 3, 0),
+                /*  6 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp4Type::TimeExceeded), 2, 11),
+
+                // Echo reply
+                /*  7 */ BPF_STMT(BPF_LD | BPF_W | BPF_IND, ICMP_TAG_OFFSET),
+                /*  8 */ BPF_STMT(BPF_JMP | BPF_JA, 6),
+
+                // Error, X += inner IP header length
+                /*  9 */ BPF_STMT(BPF_LD | BPF_B | BPF_IND, ICMP_ERR_HDR_LEN),
+                /* 10 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0f),
+                /* 11 */ BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+                /* 12 */ BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+                /* 13 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+                /* 14 */ BPF_STMT(BPF_LD | BPF_W | BPF_IND, ICMP_ERR_HDR_LEN + ICMP_TAG_OFFSET),
+
+                // tag - tag_offset < tag_count, the subtraction wraps around like the tags
+                /* 15 */ BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, tag_offset),
+                /* 16 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, tag_count, 1, 0),
+                /* 17 */ BPF_STMT(BPF_RET | BPF_K, BPF_ACCEPT),
+                /* 18 */ BPF_STMT(BPF_RET | BPF_K, 0),
+            };
+
+            return packet_socket ? check_protocol(program, IP4_PROTOCOL_OFFSET, IPPROTO_ICMP) : program;
+
+        case AddressFamily::Inet6:
+            program = {
+                /*  0 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, icmp6_off),
+                /*  1 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp6Type::EchoReply), 3, 0),
+                /*  2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp6Type::DstUnreach), 4, 0),
+                /*  3 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp6Type::TimeExceeded), 3, 0),
+                /*  4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<u_int8_t>(Icmp6Type::ParamProb), 2, 6),
+
+                // Echo reply
+                /*  5 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, icmp6_off + ICMP_TAG_OFFSET),
+                /*  6 */ BPF_STMT(BPF_JMP | BPF_JA, 1),
+
+                // Error, the quoted IPv6 header has a fixed length
+                /*  7 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, icmp6_off + ICMP_ERR_HDR_LEN + IP6_HDR_LEN + ICMP_TAG_OFFSET),
+
+                // tag - tag_offset < tag_count
+                /*  8 */ BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, tag_offset),
+                /*  9 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, tag_count, 1, 0),
+                /* 10 */ BPF_STMT(BPF_RET | BPF_K, BPF_ACCEPT),
+                /* 11 */ BPF_STMT(BPF_RET | BPF_K, 0),
+            };
+
+            return packet_socket ? check_protocol(program, IP6_NEXT_HEADER_OFFSET, IPPROTO_ICMPV6) : program;
+
+        default:
+            throw std::runtime_error("Unhandled family in make_reply_filter");
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef NET_ICMP_FILTER_H
+#define NET_ICMP_FILTER_H
+
+#include "enums.h"
+
+#include <linux/filter.h>
+#include <cstdint>
+#include <vector>
+
+/*
+ * ICMP types which Inet4::resp_status / Inet6::resp_status understand, any other type is of
+ * no use for matching replies to probes.
+ */
+std::vector<u_int8_t> reply_icmp_types(AddressFamily af);
+
+/*
+ * Function builds a classic BPF program for a raw ICMP socket of the given family.
+ * The program passes only Echo Replies and errors from reply_icmp_types whose tag
+ * (ID << 16 | SEQ of the echo reply itself or of the quoted echo request) is one of
+ * tag_offset ... tag_offset + tag_count - 1 (mod 2^32), see ProbeCodec.
+ *
+ * IPv4 raw sockets see the packet from the IP header, IPv6 raw sockets from
+ * the ICMPv6 header. With packet_socket the program is for a PacketRing instead, which
+ * sees every packet of the family from its IP header; packets of other protocols (and
+ * IPv6 packets with extension headers) are dropped too.
+ */
+std::vector<struct sock_filter> make_reply_filter(AddressFamily af, u_int32_t tag_offset, u_int32_t tag_count,
+                                                  bool packet_socket = false);
+
+#endif // NET_ICMP_FILTER_H
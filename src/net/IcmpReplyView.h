@@ -0,0 +1,161 @@
+#ifndef NET_ICMP_REPLY_VIEW_H
+#define NET_ICMP_REPLY_VIEW_H
+
+#include "enums.h"
+#include "FamilyTraits.h"
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/*
+ * Class IcmpReplyView decodes a packet read from a raw ICMP socket of the given family
+ * (Inet4 or Inet6) in place. It does not own or copy the buffer, which must outlive the view.
+ *
+ * For an Echo Reply the echo header is the ICMP header itself, for an error it is the
+ * ICMP header of our echo request quoted in the error message:
+ *
+ *                                 ICMPv4 ERROR responses
+ *
+ *   ***************** ***************** ***************** ***************************
+ *   *  IPv4 header  * *  ICMPv4 error * *  IPv4 header  * *  original ICMPv4 header *
+ *   *   ~20 bytes   * *    8 bytes    * *   ~20 bytes   * *          8 bytes        *
+ *   ***************** ***************** ***************** ***************************
+ *
+ *  Echo replies contain IPv4 header and ICMPv4 Echo reply message
+ *
+ *                                  ICMPv6 ERROR responses
+ *
+ *             ***************** ***************** ***************************
+ *             *  ICMPv6 error * *  IPv6 header  * *  original ICMPv6 header *
+ *             *    8 bytes    * *    40 bytes   * *          8 bytes        *
+ *             ***************** ***************** ***************************
+ *
+ *  Echo replies contain only ICMPv6 Echo reply message
+ */
+template <typename Family>
+class IcmpReplyView {
+public:
+    static constexpr size_t ICMP_HDR_LEN = 8;
+
+    IcmpReplyView(const char *buf, size_t length) {
+        // Offset of the ICMP header
+        size_t icmp_off = 0;
+
+        if (Family::recv_ip_hdr) {
+            if (length < Family::min_ip_hdr_len) {
+                return;
+            }
+
+            icmp_off = Family::ip_hdr_len(buf);
+            if (icmp_off < Family::min_ip_hdr_len) {
+                return;
+            }
+        }
+
+        if (length < icmp_off + ICMP_HDR_LEN) {
+            return;
+        }
+
+        status_ = Family::resp_status(buf[icmp_off], buf[icmp_off + 1]);
+
+        size_t echo_off;
+        switch (status_) {
+            case IcmpRespStatus::Unknown:
+                return;
+            case IcmpRespStatus::EchoReply:
+                echo_off = icmp_off;
+                break;
+            default: {
+                size_t inner_off = icmp_off + ICMP_HDR_LEN;
+                if (length < inner_off + Family::min_ip_hdr_len) {
+                    return;
+                }
+
+                size_t inner_len = Family::ip_hdr_len(buf + inner_off);
+                if (inner_len < Family::min_ip_hdr_len) {
+                    return;
+                }
+
+                quoted_ip_ = buf + inner_off;
+                echo_off = inner_off + inner_len;
+            }
+        }
+
+        if (length >= echo_off + ICMP_HDR_LEN) {
+            echo_ = buf + echo_off;
+            echo_length_ = length - echo_off;
+        }
+    }
+
+    /* False if the packet is truncated or of no use for traceroute */
+    bool is_valid() const {
+        return echo_ != nullptr;
+    }
+
+    IcmpRespStatus get_resp_status() const {
+        return status_;
+    }
+
+    /* ID and SEQ of the echo header, valid views only */
+    u_int16_t get_id() const {
+        return read16_(echo_ + 4);
+    }
+
+    u_int16_t get_seq() const {
+        return read16_(echo_ + 6);
+    }
+
+    /* ID and SEQ together, ID in the upper half */
+    u_int32_t get_tag() const {
+        return read32_(echo_ + 4);
+    }
+
+    /*
+     * Method reads a 32 bit word at offset from the start of the echo header. Returns false
+     * if the reply does not contain it (errors may quote as little as the echo header).
+     */
+    bool read_echo32(size_t offset, u_int32_t &value) const {
+        if (echo_length_ < offset + sizeof (value)) {
+            return false;
+        }
+
+        value = read32_(echo_ + offset);
+        return true;
+    }
+
+    /* IP header of the probe quoted in an error, nullptr for an Echo Reply */
+    const char *get_quoted_ip_ptr() const {
+        return quoted_ip_;
+    }
+
+    /* Echo header and whatever follows it in the buffer */
+    const char *get_echo_ptr() const {
+        return echo_;
+    }
+
+    size_t get_echo_length() const {
+        return echo_length_;
+    }
+
+private:
+    IcmpRespStatus status_ = IcmpRespStatus::Unknown;
+    const char *echo_ = nullptr;
+    size_t echo_length_ = 0;
+    const char *quoted_ip_ = nullptr;
+
+    static u_int16_t read16_(const char *p) {
+        u_int16_t value;
+        memcpy(&value, p, sizeof (value));
+        return ntohs(value);
+    }
+
+    static u_int32_t read32_(const char *p) {
+        u_int32_t value;
+        memcpy(&value, p, sizeof (value));
+        return ntohl(value);
+    }
+};
+
+#endif // NET_ICMP_REPLY_VIEW_H
@@ -0,0 +1,194 @@
+#include "IoUring.h"
+
+#include <algorithm>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+
+IoUring::IoUring(unsigned sq_entries, unsigned cq_entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof (params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, sq_entries, &params));
+    if (fd_ == -1) {
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+    }
+
+    try {
+        sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof (u_int32_t);
+        cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+
+        // Both queues are in a single mapping since Linux 5.4
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+        }
+
+        sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd_, IORING_OFF_SQ_RING);
+        if (sq_map_ == MAP_FAILED) {
+            sq_map_ = nullptr;
+            throw std::system_error(errno, std::generic_category(), "mmap of the submission queue");
+        }
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_map_ = sq_map_;
+            cq_map_size_ = 0;
+        } else {
+            cq_map_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           fd_, IORING_OFF_CQ_RING);
+            if (cq_map_ == MAP_FAILED) {
+                cq_map_ = nullptr;
+                throw std::system_error(errno, std::generic_category(), "mmap of the completion queue");
+            }
+        }
+
+        sqes_size_ = params.sq_entries * sizeof (struct io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap of the submission entries");
+        }
+
+        sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+    } catch (...) {
+        release_();
+        throw;
+    }
+
+    char *sq = static_cast<char *>(sq_map_);
+    char *cq = static_cast<char *>(cq_map_);
+
+    sq_head_ = reinterpret_cast<u_int32_t *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<u_int32_t *>(sq + params.sq_off.tail);
+    sq_flags_ = reinterpret_cast<u_int32_t *>(sq + params.sq_off.flags);
+    sq_mask_ = *reinterpret_cast<u_int32_t *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+
+    cq_head_ = reinterpret_cast<u_int32_t *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<u_int32_t *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<u_int32_t *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Entries are always used in order, slot k of the array is entry k for good
+    u_int32_t *array = reinterpret_cast<u_int32_t *>(sq + params.sq_off.array);
+    for (u_int32_t k = 0; k < sq_entries_; ++k) {
+        array[k] = k;
+    }
+
+    sq_pending_tail_ = *sq_tail_;
+}
+
+IoUring::~IoUring() {
+    release_();
+}
+
+void IoUring::release_() {
+    if (sqes_ != nullptr) {
+        munmap(sqes_, sqes_size_);
+    }
+
+    if (cq_map_ != nullptr && cq_map_ != sq_map_) {
+        munmap(cq_map_, cq_map_size_);
+    }
+
+    if (sq_map_ != nullptr) {
+        munmap(sq_map_, sq_map_size_);
+    }
+
+    if (fd_ != -1) {
+        close(fd_);
+    }
+
+    sqes_ = nullptr;
+    cq_map_ = sq_map_ = nullptr;
+    fd_ = -1;
+}
+
+int IoUring::get_fd() const {
+    return fd_;
+}
+
+struct io_uring_sqe *IoUring::get_sqe() {
+    u_int32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+    if (sq_pending_tail_ - head >= sq_entries_) {
+        return nullptr;
+    }
+
+    struct io_uring_sqe *sqe = &sqes_[sq_pending_tail_ & sq_mask_];
+    memset(sqe, 0, sizeof (*sqe));
+    ++sq_pending_tail_;
+
+    return sqe;
+}
+
+int IoUring::enter_(unsigned to_submit, unsigned wait_for, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, wait_for, flags, nullptr, 0));
+}
+
+void IoUring::submit(unsigned wait_for) {
+    __atomic_store_n(sq_tail_, sq_pending_tail_, __ATOMIC_RELEASE);
+
+    while (true) {
+        // Entries the kernel has not consumed yet, a signal may interrupt it halfway
+        unsigned to_submit = sq_pending_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+        if (to_submit == 0 && wait_for == 0) {
+            return;
+        }
+
+        if (enter_(to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0) != -1) {
+            return;
+        }
+
+        if (errno != EINTR) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+        }
+
+        // Completions which arrived meanwhile count
+        wait_for = 0;
+    }
+}
+
+const struct io_uring_cqe *IoUring::peek_cqe() {
+    u_int32_t head = *cq_head_;
+
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        // Completions which did not fit into the queue wait in the kernel until it is entered
+        if (!(__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+            return nullptr;
+        }
+
+        if (enter_(0, 0, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+        }
+
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            return nullptr;
+        }
+    }
+
+    return &cqes_[head & cq_mask_];
+}
+
+void IoUring::cqe_seen() {
+    __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
+
+void IoUring::register_buf_ring(struct io_uring_buf_ring *ring, unsigned entries, u_int16_t group) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof (reg));
+    reg.ring_addr = reinterpret_cast<u_int64_t>(ring);
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        throw std::system_error(errno, std::generic_category(), "IORING_REGISTER_PBUF_RING");
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef NET_IO_URING_H
+#define NET_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/types.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Class IoUring is a single io_uring instance: its submission and completion queues
+ * mapped into memory and the io_uring_setup/enter/register system calls, which the C
+ * library does not wrap. Queues are not synchronized, every ring is used by one thread.
+ */
+class IoUring {
+public:
+    /* Throws std::system_error if the kernel has no (or a disabled) io_uring */
+    IoUring(unsigned sq_entries, unsigned cq_entries);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    /* Descriptor which becomes readable when completions are waiting */
+    int get_fd() const;
+
+    /* Cleared entry to fill, nullptr if the submission queue is full */
+    struct io_uring_sqe *get_sqe();
+
+    /* Method submits the entries filled since the last call and waits for wait_for completions */
+    void submit(unsigned wait_for = 0);
+
+    /* Oldest completion not seen yet, nullptr if there is none */
+    const struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    /* Registers a ring of provided buffers (IORING_REGISTER_PBUF_RING) as buffer group group */
+    void register_buf_ring(struct io_uring_buf_ring *ring, unsigned entries, u_int16_t group);
+
+private:
+    int fd_ = -1;
+
+    void *sq_map_ = nullptr;
+    size_t sq_map_size_ = 0;
+    void *cq_map_ = nullptr;
+    size_t cq_map_size_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    // Shared with the kernel
+    u_int32_t *sq_head_ = nullptr;
+    u_int32_t *sq_tail_ = nullptr;
+    u_int32_t *sq_flags_ = nullptr;
+    u_int32_t *cq_head_ = nullptr;
+    u_int32_t *cq_tail_ = nullptr;
+    struct io_uring_cqe *cqes_ = nullptr;
+
+    u_int32_t sq_mask_ = 0;
+    u_int32_t sq_entries_ = 0;
+    u_int32_t cq_mask_ = 0;
+
+    // Tail of the entries filled by get_sqe, the kernel sees it on submit
+    u_int32_t sq_pending_tail_ = 0;
+
+    void release_();
+    int enter_(unsigned to_submit, unsigned wait_for, unsigned flags);
+};
+
+#endif // NET_IO_URING_H
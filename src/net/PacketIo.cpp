@@ -0,0 +1,43 @@
+#include "PacketIo.h"
+
+#include <sys/socket.h>
+#include <chrono>
+#include <cstddef>
+
+RecvBatch::RecvBatch(size_t capacity, size_t buf_size) :
+    packets_(capacity), lengths_(capacity), from_(capacity), hop_limits_(capacity, -1), recv_times_(capacity),
+    bufs_(capacity * buf_size), iovs_(capacity), msgs_(capacity), cmsgs_(capacity * CMSG_SPACE(sizeof (int)))
+{
+    for (size_t i = 0; i < capacity; ++i) {
+        iovs_[i].iov_base = bufs_.data() + i * buf_size;
+        iovs_[i].iov_len = buf_size;
+    }
+}
+
+size_t RecvBatch::capacity() const {
+    return packets_.size();
+}
+
+size_t RecvBatch::size() const {
+    return size_;
+}
+
+const char *RecvBatch::get_packet_ptr(size_t i) const {
+    return packets_[i];
+}
+
+size_t RecvBatch::get_length(size_t i) const {
+    return lengths_[i];
+}
+
+const Address &RecvBatch::get_from(size_t i) const {
+    return from_[i];
+}
+
+int RecvBatch::get_hop_limit(size_t i) const {
+    return hop_limits_[i];
+}
+
+std::chrono::steady_clock::time_point RecvBatch::get_recv_time(size_t i) const {
+    return recv_times_[i];
+}
@@ -0,0 +1,104 @@
+#ifndef NET_PACKET_IO_H
+#define NET_PACKET_IO_H
+
+#include "Address.h"
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+template <typename Family>
+class PacketRing;
+
+/* A single packet of a batch sent by PacketIo::send_batch */
+struct OutPacket {
+    const char *buf;
+    size_t length;
+    const Address *to;
+
+    // TTL (hop limit) of this packet only, the socket's TTL is not changed
+    int ttl;
+};
+
+/*
+ * Class RecvBatch holds the packets read by a single PacketIo::recv_batch call and the
+ * preallocated buffers of Socket, so that receiving does not allocate. Packets of a
+ * PacketRing (UringSocket) point into the ring (its provided buffers) instead and stay
+ * valid until the next recv_batch.
+ *
+ * A packet is what a raw ICMP socket of its family would return: the IPv4 header
+ * followed by the ICMP message, or the ICMPv6 message alone.
+ */
+class RecvBatch {
+public:
+    RecvBatch(size_t capacity, size_t buf_size);
+
+    size_t capacity() const;
+
+    /* Number of packets filled by the last recv_batch */
+    size_t size() const;
+
+    const char *get_packet_ptr(size_t i) const;
+    size_t get_length(size_t i) const;
+    const Address &get_from(size_t i) const;
+
+    /* TTL (hop limit) the packet arrived with, -1 if it is not known */
+    int get_hop_limit(size_t i) const;
+
+    std::chrono::steady_clock::time_point get_recv_time(size_t i) const;
+
+private:
+    friend class Socket;
+    friend class UringSocket;
+
+    template <typename Family>
+    friend class PacketRing;
+
+    size_t size_ = 0;
+
+    std::vector<const char *> packets_;
+    std::vector<size_t> lengths_;
+    std::vector<Address> from_;
+    std::vector<int> hop_limits_;
+    std::vector<std::chrono::steady_clock::time_point> recv_times_;
+
+    // recvmmsg buffers of Socket, its packets_ point into bufs_
+    std::vector<char> bufs_;
+    std::vector<struct iovec> iovs_;
+    std::vector<struct mmsghdr> msgs_;
+
+    // Ancillary data of every packet, room for a single int
+    std::vector<char> cmsgs_;
+};
+
+/*
+ * Class PacketIo is the packet I/O of a prober: Socket (a raw ICMP socket), UringSocket
+ * (the same through io_uring) or PacketRing (an AF_PACKET socket with mapped rings).
+ * Sending and receiving may run in different threads at the same time, each always in
+ * the same one.
+ */
+class PacketIo {
+public:
+    virtual ~PacketIo() = default;
+
+    /* Descriptor which becomes readable when packets are waiting */
+    virtual int get_fd() const = 0;
+
+    /* Method sends all count packets, each with its own destination and TTL */
+    virtual void send_batch(const OutPacket *packets, size_t count) = 0;
+
+    /*
+     * Method receives as many waiting packets as fit into the batch. It does not block,
+     * returns the number of packets received (0 if there was nothing to read).
+     */
+    virtual size_t recv_batch(RecvBatch &batch) = 0;
+
+    /* Attaches a classic BPF program (SO_ATTACH_FILTER), packets it rejects are never queued */
+    virtual void attach_filter(const std::vector<struct sock_filter> &program) = 0;
+};
+
+#endif // NET_PACKET_IO_H
@@ -0,0 +1,443 @@
+#include "PacketRing.h"
+#include "PacketIo.h"
+#include "Route.h"
+#include "Socket.h"
+#include "FamilyTraits.h"
+#include "utility.h"
+#include "enums.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <unistd.h>
+
+// Receive ring of 4 MiB, as big as the receive buffer of a raw socket
+constexpr u_int32_t RX_BLOCK_SIZE = 1 << 16;
+constexpr u_int32_t RX_BLOCK_COUNT = 64;
+
+// Only used to count the frames of a TPACKET_V3 ring, packets are packed in the blocks
+constexpr u_int32_t RX_FRAME_SIZE = 2048;
+
+// Kernel passes a block over at latest this many milliseconds after its first packet
+constexpr u_int32_t RX_BLOCK_TIMEOUT = 1;
+
+// 1024 frames, big enough for any probe
+constexpr u_int32_t TX_FRAME_SIZE = 256;
+constexpr u_int32_t TX_BLOCK_SIZE = 1 << 12;
+constexpr u_int32_t TX_BLOCK_COUNT = 64;
+constexpr size_t TX_FRAME_COUNT = TX_BLOCK_SIZE / TX_FRAME_SIZE * TX_BLOCK_COUNT;
+
+// Packet starts right after the frame header, its sockaddr_ll is not used for sending
+constexpr size_t TX_DATA_OFFSET = TPACKET_ALIGN(sizeof (struct tpacket3_hdr));
+constexpr size_t RX_ADDR_OFFSET = TPACKET_ALIGN(sizeof (struct tpacket3_hdr));
+
+// Neighbour table is checked this often until the next hop of the ring is resolved
+constexpr std::chrono::milliseconds RESOLVE_CHECK_INTERVAL(20);
+
+// Destinations whose route is remembered, the table is cleared when it is full
+constexpr size_t ROUTE_CACHE_MAX = 1 << 18;
+
+constexpr u_int8_t IP4_VERSION_IHL = 0x45;
+constexpr u_int32_t IP6_VERSION = 6;
+constexpr size_t IP4_CHECKSUM_OFFSET = 10;
+constexpr size_t ICMP_CHECKSUM_OFFSET = 2;
+
+/* One's complement sum of the 16 bit words of buf added to sum, not folded */
+static u_int32_t ones_sum(const char *buf, size_t length, u_int32_t sum) {
+    size_t k = 0;
+
+    for (; k + 1 < length; k += 2) {
+        u_int16_t word;
+        memcpy(&word, buf + k, sizeof (word));
+        sum += word;
+    }
+
+    if (k < length) {
+        u_int16_t word = 0;
+        memcpy(&word, buf + k, 1);
+        sum += word;
+    }
+
+    return sum;
+}
+
+/* Folded and inverted sum, in the byte order of the summed words */
+static u_int16_t fold_checksum(u_int32_t sum) {
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+
+    return static_cast<u_int16_t>(~sum);
+}
+
+template <typename Family>
+PacketRing<Family>::PacketRing(const Address &dest) :
+    route_(find_route(dest)),
+    resolve_checked_(std::chrono::steady_clock::now()),
+    fallback_(Family::family, SocketType::Raw, Family::protocol)
+{
+    // Fallback socket only sends, the ring receives the replies to its probes too
+    fallback_.attach_filter({BPF_STMT(BPF_RET | BPF_K, 0)});
+
+    try {
+        fd_ = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd_ == -1) {
+            throw std::system_error(errno, std::generic_category(), "AF_PACKET socket");
+        }
+
+        int version = TPACKET_V3;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version, sizeof (version)) == -1) {
+            throw std::system_error(errno, std::generic_category(), "PACKET_VERSION");
+        }
+
+        struct tpacket_req3 rx = {};
+        rx.tp_block_size = RX_BLOCK_SIZE;
+        rx.tp_block_nr = RX_BLOCK_COUNT;
+        rx.tp_frame_size = RX_FRAME_SIZE;
+        rx.tp_frame_nr = RX_BLOCK_SIZE / RX_FRAME_SIZE * RX_BLOCK_COUNT;
+        rx.tp_retire_blk_tov = RX_BLOCK_TIMEOUT;
+
+        if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &rx, sizeof (rx)) == -1) {
+            throw std::system_error(errno, std::generic_category(), "PACKET_RX_RING");
+        }
+
+        struct tpacket_req3 tx = {};
+        tx.tp_block_size = TX_BLOCK_SIZE;
+        tx.tp_block_nr = TX_BLOCK_COUNT;
+        tx.tp_frame_size = TX_FRAME_SIZE;
+        tx.tp_frame_nr = TX_FRAME_COUNT;
+
+        if (setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &tx, sizeof (tx)) == -1) {
+            throw std::system_error(errno, std::generic_category(), "PACKET_TX_RING");
+        }
+
+        // Transmit ring follows the receive ring in the mapping
+        map_size_ = static_cast<size_t>(RX_BLOCK_SIZE) * RX_BLOCK_COUNT +
+                    static_cast<size_t>(TX_BLOCK_SIZE) * TX_BLOCK_COUNT;
+        void *map = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+
+        if (map == MAP_FAILED) {
+            map_size_ = 0;
+            throw std::system_error(errno, std::generic_category(), "mmap of the rings");
+        }
+
+        map_ = static_cast<char *>(map);
+
+        // Frames go straight to the driver, and our own frames are not received back.
+        // Both are optimizations older kernels may lack, outgoing packets are skipped anyway
+        int on = 1;
+        (void) setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS, &on, sizeof (on));
+        (void) setsockopt(fd_, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof (on));
+
+        struct sockaddr_ll bound = {};
+        bound.sll_family = AF_PACKET;
+        bound.sll_protocol = htons(Family::ether_type);
+
+        if (bind(fd_, reinterpret_cast<struct sockaddr *>(&bound), sizeof (bound)) == -1) {
+            throw std::system_error(errno, std::generic_category(), "bind of the AF_PACKET socket");
+        }
+    } catch (...) {
+        release_();
+        throw;
+    }
+
+    set_next_hop_();
+    memcpy(source_, Family::addr_ptr(route_.source.get_sockaddr_ptr()), Family::addr_len);
+}
+
+template <typename Family>
+PacketRing<Family>::~PacketRing() {
+    release_();
+}
+
+template <typename Family>
+void PacketRing<Family>::release_() {
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+    }
+
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+template <typename Family>
+void PacketRing<Family>::set_next_hop_() {
+    next_hop_ = sockaddr_ll();
+    next_hop_.sll_family = AF_PACKET;
+    next_hop_.sll_protocol = htons(Family::ether_type);
+    next_hop_.sll_ifindex = route_.ifindex;
+    next_hop_.sll_halen = route_.link_addr.size();
+    memcpy(next_hop_.sll_addr, route_.link_addr.data(), std::min(route_.link_addr.size(), sizeof (next_hop_.sll_addr)));
+}
+
+template <typename Family>
+int PacketRing<Family>::get_fd() const {
+    return fd_;
+}
+
+template <typename Family>
+struct tpacket_block_desc *PacketRing<Family>::rx_block_ptr_(size_t block) const {
+    return reinterpret_cast<struct tpacket_block_desc *>(map_ + block * RX_BLOCK_SIZE);
+}
+
+template <typename Family>
+char *PacketRing<Family>::tx_frame_ptr_(size_t frame) const {
+    return map_ + static_cast<size_t>(RX_BLOCK_SIZE) * RX_BLOCK_COUNT + frame * TX_FRAME_SIZE;
+}
+
+/* Method writes the IP header and the ICMP message of packet from ip on, returns the length */
+template <typename Family>
+size_t PacketRing<Family>::write_packet_(char *ip, const OutPacket &packet) {
+    const char *dest = Family::addr_ptr(packet.to->get_sockaddr_ptr());
+    size_t length = Family::min_ip_hdr_len + packet.length;
+
+    memcpy(ip + Family::min_ip_hdr_len, packet.buf, packet.length);
+
+    if (Family::family == AddressFamily::Inet) {
+        u_int16_t total = htons(length), id = htons(ip_id_++), zero = 0;
+
+        ip[0] = IP4_VERSION_IHL;
+        ip[1] = 0;
+        memcpy(ip + 2, &total, sizeof (total));
+        memcpy(ip + 4, &id, sizeof (id));
+        memcpy(ip + 6, &zero, sizeof (zero));
+        ip[Family::hop_limit_offset] = packet.ttl;
+        ip[Family::next_header_offset] = static_cast<int>(Protocol::ICMP);
+        memcpy(ip + IP4_CHECKSUM_OFFSET, &zero, sizeof (zero));
+        memcpy(ip + Family::src_addr_offset, source_, Family::addr_len);
+        memcpy(ip + Family::dst_addr_offset, dest, Family::addr_len);
+
+        u_int16_t checksum = compute_checksum(reinterpret_cast<u_int16_t *>(ip), Family::min_ip_hdr_len);
+        memcpy(ip + IP4_CHECKSUM_OFFSET, &checksum, sizeof (checksum));
+    } else {
+        u_int32_t version = htonl(IP6_VERSION << 28);
+        u_int16_t payload = htons(packet.length), zero = 0;
+
+        memcpy(ip, &version, sizeof (version));
+        memcpy(ip + 4, &payload, sizeof (payload));
+        ip[Family::next_header_offset] = static_cast<int>(Protocol::ICMPv6);
+        ip[Family::hop_limit_offset] = packet.ttl;
+        memcpy(ip + Family::src_addr_offset, source_, Family::addr_len);
+        memcpy(ip + Family::dst_addr_offset, dest, Family::addr_len);
+
+        /*
+         * The kernel computes ICMPv6 checksums of raw sockets only. Its pseudo-header is
+         * the addresses (which lie right before the message), the length and next header.
+         */
+        char *icmp = ip + Family::min_ip_hdr_len;
+        memcpy(icmp + ICMP_CHECKSUM_OFFSET, &zero, sizeof (zero));
+
+        u_int32_t sum = ones_sum(ip + Family::src_addr_offset, 2 * Family::addr_len + packet.length,
+                                 payload + htons(static_cast<u_int16_t>(Protocol::ICMPv6)));
+        u_int16_t checksum = fold_checksum(sum);
+        memcpy(icmp + ICMP_CHECKSUM_OFFSET, &checksum, sizeof (checksum));
+    }
+
+    return length;
+}
+
+/* Method makes the kernel send every frame requested so far, it returns when they are sent */
+template <typename Family>
+void PacketRing<Family>::flush_tx_() {
+    if (sendto(fd_, nullptr, 0, 0, reinterpret_cast<struct sockaddr *>(&next_hop_), sizeof (next_hop_)) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+/* Method tells whether a probe to dest can be sent through the ring, see PacketRing */
+template <typename Family>
+bool PacketRing<Family>::takes_(const Address &dest) {
+    if (!route_.resolved) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        if (now - resolve_checked_ < RESOLVE_CHECK_INTERVAL) {
+            return false;
+        }
+
+        resolve_checked_ = now;
+
+        if (!resolve_link_addr(route_)) {
+            return false;
+        }
+
+        set_next_hop_();
+    }
+
+    route_key_.assign(Family::addr_ptr(dest.get_sockaddr_ptr()), Family::addr_len);
+
+    auto found = same_route_.find(route_key_);
+    if (found != same_route_.end()) {
+        return found->second;
+    }
+
+    if (same_route_.size() >= ROUTE_CACHE_MAX) {
+        same_route_.clear();
+    }
+
+    // Destinations without a route are left to the raw socket, which reports the error
+    bool same = false;
+
+    try {
+        Route route = find_next_hop(dest);
+
+        same = route.ifindex == route_.ifindex &&
+               memcmp(Family::addr_ptr(route.next_hop.get_sockaddr_ptr()),
+                      Family::addr_ptr(route_.next_hop.get_sockaddr_ptr()), Family::addr_len) == 0;
+    } catch (const std::runtime_error &) {
+    }
+
+    same_route_.emplace(route_key_, same);
+    return same;
+}
+
+template <typename Family>
+void PacketRing<Family>::send_batch(const OutPacket *packets, size_t count) {
+    size_t written = 0;
+    fallback_batch_.clear();
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!takes_(*packets[i].to)) {
+            fallback_batch_.push_back(packets[i]);
+            continue;
+        }
+
+        if (TX_DATA_OFFSET + Family::min_ip_hdr_len + packets[i].length > TX_FRAME_SIZE) {
+            throw std::runtime_error("Packet does not fit a frame of the transmit ring");
+        }
+
+        struct tpacket3_hdr *hdr = reinterpret_cast<struct tpacket3_hdr *>(tx_frame_ptr_(tx_frame_));
+
+        // Frames of the previous batches are sent by now, unless the ring wrapped around
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+            flush_tx_();
+        }
+
+        hdr->tp_len = write_packet_(reinterpret_cast<char *>(hdr) + TX_DATA_OFFSET, packets[i]);
+        hdr->tp_next_offset = 0;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        tx_frame_ = (tx_frame_ + 1) % TX_FRAME_COUNT;
+        ++written;
+    }
+
+    if (written > 0) {
+        flush_tx_();
+    }
+
+    if (!fallback_batch_.empty()) {
+        fallback_.send_batch(fallback_batch_.data(), fallback_batch_.size());
+    }
+}
+
+/* Method fills slot i of the batch with the packet of hdr, false if it is not one for us */
+template <typename Family>
+bool PacketRing<Family>::read_packet_(const struct tpacket3_hdr *hdr, RecvBatch &batch, size_t i,
+                                      std::chrono::nanoseconds system_to_steady) const
+{
+    const struct sockaddr_ll *from = reinterpret_cast<const struct sockaddr_ll *>(
+        reinterpret_cast<const char *>(hdr) + RX_ADDR_OFFSET);
+
+    if (from->sll_pkttype == PACKET_OUTGOING) {
+        return false;
+    }
+
+    const char *ip = reinterpret_cast<const char *>(hdr) + hdr->tp_net;
+    size_t length = hdr->tp_snaplen;
+    int protocol = static_cast<int>(Family::protocol);
+
+    if (length < Family::min_ip_hdr_len || static_cast<u_int8_t>(ip[Family::next_header_offset]) != protocol) {
+        return false;
+    }
+
+    // The batch holds what a raw socket of the family would read
+    size_t skipped = Family::recv_ip_hdr ? 0 : Family::min_ip_hdr_len;
+
+    batch.packets_[i] = ip + skipped;
+    batch.lengths_[i] = length - skipped;
+    batch.from_[i] = Family::make_address(ip + Family::src_addr_offset);
+    batch.hop_limits_[i] = static_cast<u_int8_t>(ip[Family::hop_limit_offset]);
+
+    std::chrono::nanoseconds stamp = std::chrono::seconds(hdr->tp_sec) + std::chrono::nanoseconds(hdr->tp_nsec);
+    batch.recv_times_[i] = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(stamp + system_to_steady));
+
+    return true;
+}
+
+template <typename Family>
+size_t PacketRing<Family>::recv_batch(RecvBatch &batch) {
+    // Packets of the last batch are parsed by now
+    for (size_t block : rx_done_) {
+        __atomic_store_n(&rx_block_ptr_(block)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+
+    rx_done_.clear();
+
+    // Kernel timestamps are of the system clock
+    std::chrono::nanoseconds system_to_steady =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()) -
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+    size_t n = 0;
+
+    while (n < batch.capacity()) {
+        if (rx_left_ == 0) {
+            struct tpacket_block_desc *block = rx_block_ptr_(rx_block_);
+
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+                break;
+            }
+
+            rx_left_ = block->hdr.bh1.num_pkts;
+            rx_next_ = reinterpret_cast<const char *>(block) + block->hdr.bh1.offset_to_first_pkt;
+
+            if (rx_left_ == 0) {
+                rx_done_.push_back(rx_block_);
+                rx_block_ = (rx_block_ + 1) % RX_BLOCK_COUNT;
+                continue;
+            }
+        }
+
+        const struct tpacket3_hdr *hdr = reinterpret_cast<const struct tpacket3_hdr *>(rx_next_);
+        rx_next_ += hdr->tp_next_offset;
+
+        // Block is read up, it goes back to the kernel on the next call
+        if (--rx_left_ == 0) {
+            rx_done_.push_back(rx_block_);
+            rx_block_ = (rx_block_ + 1) % RX_BLOCK_COUNT;
+        }
+
+        if (read_packet_(hdr, batch, n, system_to_steady)) {
+            ++n;
+        }
+    }
+
+    batch.size_ = n;
+    return n;
+}
+
+template <typename Family>
+void PacketRing<Family>::attach_filter(const std::vector<struct sock_filter> &program) {
+    struct sock_fprog fprog;
+    fprog.len = program.size();
+    fprog.filter = const_cast<struct sock_filter *>(program.data());
+
+    if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof (fprog)) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+template class PacketRing<Inet4>;
+template class PacketRing<Inet6>;
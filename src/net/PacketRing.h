@@ -0,0 +1,103 @@
+#ifndef NET_PACKET_RING_H
+#define NET_PACKET_RING_H
+
+#include "PacketIo.h"
+#include "Address.h"
+#include "Route.h"
+#include "Socket.h"
+#include "FamilyTraits.h"
+
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Class PacketRing is a PacketIo of the given family (Inet4 or Inet6) on an AF_PACKET
+ * socket with a TPACKET_V3 receive ring and a transmit ring mapped into memory, so
+ * packets are not copied between the kernel and the process one by one.
+ *
+ * send_batch writes every probe as a whole IP packet (the IP header, then the ICMP
+ * message of the OutPacket) into a free frame of the transmit ring and hands all of them
+ * to the kernel with a single sendto. Every frame goes to the link-layer address of the
+ * next hop of the route to the destination given to the constructor, so only probes to
+ * destinations routed the same way (looked up once per destination) take the ring. The
+ * others, and all of them while the next hop is not resolved yet, are sent through a
+ * raw socket of the family, which receives nothing.
+ *
+ * The kernel fills the receive ring with the family's packets arriving at any interface
+ * in blocks and passes a block over when it is full or RX_BLOCK_TIMEOUT passes.
+ * recv_batch points the batch into the blocks and returns them to the kernel on its next
+ * call. Timestamps are taken by the kernel as packets arrive.
+ */
+template <typename Family>
+class PacketRing : public PacketIo {
+public:
+    /*
+     * Needs CAP_NET_RAW, throws std::system_error if the socket or its rings cannot be
+     * set up and std::runtime_error if there is no route to dest.
+     */
+    explicit PacketRing(const Address &dest);
+    ~PacketRing() override;
+
+    PacketRing(const PacketRing &) = delete;
+    PacketRing &operator=(const PacketRing &) = delete;
+
+    int get_fd() const override;
+
+    void send_batch(const OutPacket *packets, size_t count) override;
+    size_t recv_batch(RecvBatch &batch) override;
+
+    /* The program sees packets from the IP header, see make_reply_filter */
+    void attach_filter(const std::vector<struct sock_filter> &program) override;
+
+private:
+    int fd_ = -1;
+    char *map_ = nullptr;
+    size_t map_size_ = 0;
+
+    Route route_;
+
+    // Every frame is sent to the next hop of route_, once it is resolved
+    struct sockaddr_ll next_hop_;
+    char source_[Family::addr_len];
+    std::chrono::steady_clock::time_point resolve_checked_;
+
+    // Whether a destination (its raw address) is routed the way of route_
+    std::unordered_map<std::string, bool> same_route_;
+    std::string route_key_;
+
+    // Probes the ring cannot take and the batch of them
+    Socket fallback_;
+    std::vector<OutPacket> fallback_batch_;
+
+    // Block read by recv_batch, its packets not read yet and the next of them
+    size_t rx_block_ = 0;
+    u_int32_t rx_left_ = 0;
+    const char *rx_next_ = nullptr;
+
+    // Blocks read up by the last recv_batch, the batch still points into them
+    std::vector<size_t> rx_done_;
+
+    // Next frame of the transmit ring to fill
+    size_t tx_frame_ = 0;
+    u_int16_t ip_id_ = 0;
+
+    void release_();
+    void set_next_hop_();
+    void flush_tx_();
+    bool takes_(const Address &dest);
+
+    struct tpacket_block_desc *rx_block_ptr_(size_t block) const;
+    char *tx_frame_ptr_(size_t frame) const;
+
+    size_t write_packet_(char *ip, const OutPacket &packet);
+    bool read_packet_(const struct tpacket3_hdr *hdr, RecvBatch &batch, size_t i,
+                      std::chrono::nanoseconds system_to_steady) const;
+};
+
+#endif // NET_PACKET_RING_H
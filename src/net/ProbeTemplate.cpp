@@ -0,0 +1,39 @@
+#include "ProbeTemplate.h"
+#include "FamilyTraits.h"
+#include "utility.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+template <typename Family>
+ProbeTemplate<Family>::ProbeTemplate(const std::vector<char> &message) {
+    // Type, code 0, checksum, ID and SEQ 0, cookie 0 followed by the message
+    packet_.assign(COOKIE_OFFSET + COOKIE_LEN + message.size(), 0);
+    packet_[0] = Family::echo_request_type;
+    memcpy(packet_.data() + COOKIE_OFFSET + COOKIE_LEN, message.data(), message.size());
+
+    if (Family::user_checksum) {
+        // compute_checksum returns checksum in a network byte-order
+        u_int16_t checksum = compute_checksum((u_int16_t *) packet_.data(), packet_.size());
+        memcpy(packet_.data() + CHECKSUM_OFFSET, &checksum, sizeof (checksum));
+
+        // ~m of the ID, SEQ and both cookie words is ~0
+        checksum_base_ = static_cast<u_int16_t>(~checksum) + 4 * 0xffff;
+    }
+}
+
+template <typename Family>
+size_t ProbeTemplate<Family>::get_length() const {
+    return packet_.size();
+}
+
+template <typename Family>
+void ProbeTemplate<Family>::fill(char *buf, size_t count) const {
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(buf + i * packet_.size(), packet_.data(), packet_.size());
+    }
+}
+
+template class ProbeTemplate<Inet4>;
+template class ProbeTemplate<Inet6>;
@@ -0,0 +1,66 @@
+#ifndef NET_PROBE_TEMPLATE_H
+#define NET_PROBE_TEMPLATE_H
+
+#include "enums.h"
+#include "FamilyTraits.h"
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Class ProbeTemplate is an ICMP Echo Request of the given family (Inet4 or Inet6)
+ * built once. Its payload is a 32 bit cookie followed by the message. Probes are made
+ * by copying the template and patching only the ID and SEQ fields (together a 32 bit
+ * tag) and the cookie.
+ *
+ * ICMPv4 checksum is updated incrementally (RFC 1624, eqn. 3):
+ *      HC' = ~(~HC + ~m + m')
+ * for each of the four changed 16 bit words, where HC is the checksum of the template
+ * and m are its (zero) tag and cookie words. ~HC + sum of ~m is the same for every probe
+ * and is computed in the constructor. The kernel computes ICMPv6 checksums itself.
+ */
+template <typename Family>
+class ProbeTemplate {
+public:
+    // Offset of the cookie in the echo header
+    static constexpr size_t COOKIE_OFFSET = 8;
+
+    explicit ProbeTemplate(const std::vector<char> &message);
+
+    size_t get_length() const;
+
+    /* Method copies the template into count consecutive packets starting at buf */
+    void fill(char *buf, size_t count) const;
+
+    /* Method sets the tag (ID << 16 | SEQ) and cookie of a packet filled from this template */
+    void patch(char *packet, u_int32_t tag, u_int32_t cookie) const {
+        u_int32_t tag_n = htonl(tag), cookie_n = htonl(cookie);
+
+        memcpy(packet + TAG_OFFSET, &tag_n, sizeof (tag_n));
+        memcpy(packet + COOKIE_OFFSET, &cookie_n, sizeof (cookie_n));
+
+        if (Family::user_checksum) {
+            u_int32_t sum = checksum_base_ + (tag_n >> 16) + (tag_n & 0xffff)
+                            + (cookie_n >> 16) + (cookie_n & 0xffff);
+            sum = (sum >> 16) + (sum & 0xffff);
+            sum += (sum >> 16);
+
+            u_int16_t checksum = ~sum;
+            memcpy(packet + CHECKSUM_OFFSET, &checksum, sizeof (checksum));
+        }
+    }
+
+private:
+    static constexpr size_t COOKIE_LEN = 4;
+    static constexpr size_t CHECKSUM_OFFSET = 2;
+    static constexpr size_t TAG_OFFSET = 4;
+
+    std::vector<char> packet_;
+
+    // ~HC + sum of ~m over the tag and cookie words of the template, in network byte-order words
+    u_int32_t checksum_base_ = 0;
+};
+
+#endif // NET_PROBE_TEMPLATE_H
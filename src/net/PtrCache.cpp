@@ -0,0 +1,94 @@
+#include "PtrCache.h"
+#include "utility.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+bool PtrCache::get(const std::string &ip, std::string &hostname) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = entries_.find(ip);
+    if (it == entries_.end() || it->second.expires <= std::time(nullptr)) {
+        return false;
+    }
+
+    hostname = it->second.hostname;
+    return true;
+}
+
+void PtrCache::put(const std::string &ip, const std::string &hostname) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    entries_[ip] = Entry{hostname, std::time(nullptr) + static_cast<std::time_t>(ttl_.count())};
+}
+
+void PtrCache::load(const std::string &path) {
+    std::ifstream in(path);
+    std::string line;
+    std::time_t now = std::time(nullptr);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Every line has a form "<ip> <expiration unix time> <hostname>"
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string ip, hostname;
+        long long expires;
+
+        if (!(fields >> ip >> expires >> hostname) || expires <= now) {
+            continue;
+        }
+
+        entries_[ip] = Entry{hostname, static_cast<std::time_t>(expires)};
+    }
+}
+
+void PtrCache::save(const std::string &path) {
+    make_parent_dirs(path);
+
+    /*
+     * Write to a temporary file first so that concurrent runs never see a partial cache.
+     * Every run has a file of its own, the last rename wins.
+     */
+    std::string tmp_path = path + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category(), tmp_path);
+    }
+
+    close(fd);
+
+    std::ofstream out(tmp_path, std::ios::trunc);
+    if (!out) {
+        int error = errno;
+        unlink(tmp_path.c_str());
+        throw std::system_error(error, std::generic_category(), tmp_path);
+    }
+
+    std::time_t now = std::time(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (const auto &entry : entries_) {
+            if (entry.second.expires > now) {
+                out << entry.first << " " << static_cast<long long>(entry.second.expires)
+                    << " " << entry.second.hostname << "\n";
+            }
+        }
+    }
+
+    out.close();
+    if (!out || std::rename(tmp_path.c_str(), path.c_str()) == -1) {
+        int error = errno;
+        unlink(tmp_path.c_str());
+        throw std::system_error(error, std::generic_category(), path);
+    }
+}
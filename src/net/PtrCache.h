@@ -0,0 +1,43 @@
+#ifndef NET_PTR_CACHE_H
+#define NET_PTR_CACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+
+/*
+ * Class PtrCache maps IP addresses (as returned by Address::get_ip_str) to their
+ * hostnames. Every entry expires ttl seconds after it was stored. The cache can be
+ * saved to a file and loaded again by a later run. All methods are thread-safe.
+ */
+class PtrCache {
+public:
+    explicit PtrCache(std::chrono::seconds ttl) : ttl_(ttl) { }
+
+    /* Method returns true and fills hostname if ip has an entry that did not expire */
+    bool get(const std::string &ip, std::string &hostname);
+    void put(const std::string &ip, const std::string &hostname);
+
+    /*
+     * Method load reads entries saved by save. A missing or malformed file is not an
+     * error, malformed lines and expired entries are skipped.
+     */
+    void load(const std::string &path);
+
+    /* Method save writes all entries that did not expire yet, missing directories are created */
+    void save(const std::string &path);
+
+private:
+    struct Entry {
+        std::string hostname;
+        std::time_t expires;
+    };
+
+    std::chrono::seconds ttl_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::mutex mutex_;
+};
+
+#endif // NET_PTR_CACHE_H
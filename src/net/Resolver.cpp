@@ -0,0 +1,151 @@
+#include "Resolver.h"
+#include "Address.h"
+#include "GaiException.h"
+#include "utility.h"
+#include "enums.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+constexpr size_t Resolver::NO_LIMIT;
+
+Resolver::Resolver(HostSource &source, AddressFamily af_if_unknown, int workers, size_t permits) :
+    af_if_unknown_(af_if_unknown), source_(source), permits_(permits)
+{
+    start_time_ = std::chrono::steady_clock::now();
+
+    size_t n_workers = static_cast<size_t>(std::max(workers, 1));
+    if (source_.is_counted()) {
+        n_workers = std::min(n_workers, source_.get_count());
+
+        // No worker would find out
+        source_done_ = (n_workers == 0);
+    }
+
+    for (size_t i = 0; i < n_workers; ++i) {
+        workers_.push_back(std::thread(&Resolver::worker_, this));
+    }
+}
+
+Resolver::~Resolver() {
+    // Let workers finish the hosts they already started with and skip the rest
+    stop();
+
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void Resolver::stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    permitted_.notify_all();
+    ready_.notify_all();
+}
+
+void Resolver::release(size_t count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (permits_ != NO_LIMIT) {
+        permits_ += count;
+        permitted_.notify_all();
+    }
+}
+
+bool Resolver::take_host_(std::string &host, size_t &index) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        permitted_.wait(lock, [this]() { return stopping_ || source_done_ || permits_ > 0; });
+
+        if (stopping_ || source_done_) {
+            return false;
+        }
+
+        if (permits_ != NO_LIMIT) {
+            --permits_;
+        }
+
+        ++started_;
+    }
+
+    bool taken;
+    {
+        std::lock_guard<std::mutex> lock(source_mutex_);
+        taken = source_.next(host);
+        index = next_index_++;
+    }
+
+    if (!taken) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (permits_ != NO_LIMIT) {
+            ++permits_;
+        }
+
+        --started_;
+        source_done_ = true;
+        permitted_.notify_all();
+        ready_.notify_all();
+    }
+
+    return taken;
+}
+
+void Resolver::worker_() {
+    ResolveResult result;
+
+    while (take_host_(result.host, result.index)) {
+        result.address = Address();
+        result.gai_code = 0;
+
+        auto lookup_start = std::chrono::steady_clock::now();
+        try {
+            result.address = str_to_address(result.host, af_if_unknown_);
+        } catch (const GaiException &e) {
+            result.gai_code = e.code();
+        }
+        auto lookup_end = std::chrono::steady_clock::now();
+
+        result.latency = std::chrono::duration_cast<std::chrono::microseconds>(lookup_end - lookup_start);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (result.gai_code) {
+            ++stats_.failed;
+        } else {
+            ++stats_.resolved;
+        }
+
+        stats_.total_latency += result.latency;
+        stats_.max_latency = std::max(stats_.max_latency, result.latency);
+        stats_.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(lookup_end - start_time_);
+
+        done_.push_back(result);
+        ready_.notify_one();
+    }
+}
+
+bool Resolver::next(ResolveResult &result) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    ready_.wait(lock, [this]() {
+        return !done_.empty() || ((source_done_ || stopping_) && delivered_ == started_);
+    });
+
+    if (done_.empty()) {
+        return false;
+    }
+
+    result = done_.front();
+    done_.pop_front();
+    ++delivered_;
+
+    return true;
+}
+
+ResolverStats Resolver::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,100 @@
+#ifndef NET_RESOLVER_H
+#define NET_RESOLVER_H
+
+#include "Address.h"
+#include "HostSource.h"
+#include "enums.h"
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/* Outcome of a single forward lookup */
+struct ResolveResult {
+    // Host as given by the user and its position in the input
+    std::string host;
+    size_t index;
+    Address address;
+
+    // 0 on success, otherwise getaddrinfo error code
+    int gai_code;
+    std::chrono::microseconds latency;
+};
+
+struct ResolverStats {
+    size_t resolved = 0;
+    size_t failed = 0;
+    std::chrono::microseconds elapsed = std::chrono::microseconds(0);
+    std::chrono::microseconds total_latency = std::chrono::microseconds(0);
+    std::chrono::microseconds max_latency = std::chrono::microseconds(0);
+};
+
+/*
+ * Class Resolver translates hostnames (or IP literals) to Addresses using a pool of
+ * worker threads, so that at most `workers` getaddrinfo calls are in flight at once.
+ * Lookups start in the constructor and results are handed out by next() in the order
+ * they complete, not in the input order.
+ *
+ * Hosts are taken from the source only while there are permits left, one permit per
+ * host. The caller returns a permit by release() once it is done with a host, which
+ * bounds the number of hosts in flight. Without a limit hosts are taken as fast as
+ * they can be resolved.
+ */
+class Resolver {
+public:
+    static constexpr size_t NO_LIMIT = static_cast<size_t>(-1);
+
+    Resolver(HostSource &source, AddressFamily af_if_unknown, int workers, size_t permits = NO_LIMIT);
+
+    /* Method returns permits of hosts the caller is done with, can be called from any thread */
+    void release(size_t count);
+
+    /*
+     * Method stops taking hosts from the source, next() hands out the lookups already
+     * started and then returns false. A worker waiting for pushed hosts still waits until
+     * the next one comes or the source is closed.
+     */
+    void stop();
+
+    /*
+     * Method blocks until another lookup completes and stores it in result. Returns false
+     * when every result has already been handed out.
+     */
+    bool next(ResolveResult &result);
+
+    ResolverStats get_stats();
+
+    ~Resolver();
+private:
+    void worker_();
+
+    /* Method waits for a permit and takes the next host, returns false if there is none */
+    bool take_host_(std::string &host, size_t &index);
+
+    AddressFamily af_if_unknown_;
+    std::vector<std::thread> workers_;
+
+    // Source is read outside of mutex_, waiting for pushed hosts may block for long
+    HostSource &source_;
+    std::mutex source_mutex_;
+    size_t next_index_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable permitted_;
+    std::deque<ResolveResult> done_;
+    size_t permits_;
+    size_t started_ = 0;
+    size_t delivered_ = 0;
+    bool source_done_ = false;
+    bool stopping_ = false;
+
+    std::chrono::steady_clock::time_point start_time_;
+    ResolverStats stats_;
+};
+
+#endif // NET_RESOLVER_H
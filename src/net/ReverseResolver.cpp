@@ -0,0 +1,73 @@
+#include "ReverseResolver.h"
+#include "Address.h"
+#include "PtrCache.h"
+#include "GaiException.h"
+
+#include <string>
+#include <algorithm>
+
+ReverseResolver::ReverseResolver(PtrCache &cache, int workers) : cache_(cache) {
+    for (int i = 0; i < std::max(workers, 1); ++i) {
+        workers_.push_back(std::thread(&ReverseResolver::worker_, this));
+    }
+}
+
+ReverseResolver::~ReverseResolver() {
+    finish();
+}
+
+void ReverseResolver::submit(const Address &address) {
+    std::string ip = address.get_ip_str();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (finishing_ || !seen_.insert(ip).second) {
+        return;
+    }
+
+    std::string hostname;
+    if (cache_.get(ip, hostname)) {
+        return;
+    }
+
+    queue_.push_back(address);
+    queued_.notify_one();
+}
+
+void ReverseResolver::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finishing_ = true;
+        queued_.notify_all();
+    }
+
+    for (auto &worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void ReverseResolver::worker_() {
+    while (true) {
+        Address address;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this]() { return finishing_ || !queue_.empty(); });
+
+            if (queue_.empty()) {
+                return;
+            }
+
+            address = queue_.front();
+            queue_.pop_front();
+        }
+
+        try {
+            cache_.put(address.get_ip_str(), address.retrieve_hostname());
+        } catch (const GaiException &e) {
+            // Failed lookups are not cached, the IP is printed instead
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef NET_REVERSE_RESOLVER_H
+#define NET_REVERSE_RESOLVER_H
+
+#include "Address.h"
+#include "PtrCache.h"
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Class ReverseResolver looks up hostnames of submitted addresses in the background
+ * using a pool of worker threads and stores them in the given PtrCache. Every IP is
+ * looked up at most once and not at all if the cache already knows it.
+ */
+class ReverseResolver {
+public:
+    ReverseResolver(PtrCache &cache, int workers);
+
+    /* Method only queues the lookup, it never blocks on DNS */
+    void submit(const Address &address);
+
+    /* Method waits until all submitted lookups are done and stops the workers */
+    void finish();
+
+    ~ReverseResolver();
+private:
+    void worker_();
+
+    PtrCache &cache_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::deque<Address> queue_;
+
+    // IPs that were already submitted
+    std::unordered_set<std::string> seen_;
+    bool finishing_ = false;
+};
+
+#endif // NET_REVERSE_RESOLVER_H
@@ -0,0 +1,303 @@
+#include "Route.h"
+#include "Address.h"
+#include "enums.h"
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <system_error>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+#include <unistd.h>
+
+// Port of the datagram which makes the kernel resolve a next hop (discard)
+constexpr u_int16_t RESOLVE_PORT = 9;
+
+// Link-layer address length of the loopback interface, which takes any address
+constexpr size_t LOOPBACK_ADDR_LEN = 6;
+
+constexpr size_t NETLINK_BUF_SIZE = 32 * 1024;
+
+/* Raw bytes and length of the IP address in addr */
+static const void *ip_bytes(const Address &addr, size_t &length) {
+    const sockaddr *sa = addr.get_sockaddr_ptr();
+
+    if (addr.get_family() == AddressFamily::Inet) {
+        length = sizeof (in_addr);
+        return &reinterpret_cast<const sockaddr_in *>(sa)->sin_addr;
+    }
+
+    length = sizeof (in6_addr);
+    return &reinterpret_cast<const sockaddr_in6 *>(sa)->sin6_addr;
+}
+
+static Address make_address(AddressFamily family, const void *bytes) {
+    sockaddr_storage ss = {};
+
+    if (family == AddressFamily::Inet) {
+        sockaddr_in *sa = reinterpret_cast<sockaddr_in *>(&ss);
+        sa->sin_family = AF_INET;
+        memcpy(&sa->sin_addr, bytes, sizeof (in_addr));
+        return Address(reinterpret_cast<const sockaddr *>(sa), sizeof (sockaddr_in));
+    }
+
+    sockaddr_in6 *sa = reinterpret_cast<sockaddr_in6 *>(&ss);
+    sa->sin6_family = AF_INET6;
+    memcpy(&sa->sin6_addr, bytes, sizeof (in6_addr));
+    return Address(reinterpret_cast<const sockaddr *>(sa), sizeof (sockaddr_in6));
+}
+
+/* UDP socket connected to port of addr, the caller closes it */
+static int connect_udp(const Address &addr, u_int16_t port) {
+    sockaddr_storage ss;
+    memcpy(&ss, addr.get_sockaddr_ptr(), addr.get_length());
+
+    if (addr.get_family() == AddressFamily::Inet) {
+        reinterpret_cast<sockaddr_in *>(&ss)->sin_port = htons(port);
+    } else {
+        reinterpret_cast<sockaddr_in6 *>(&ss)->sin6_port = htons(port);
+    }
+
+    int fd = socket(static_cast<int>(addr.get_family()), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&ss), addr.get_length()) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "connect to " + addr.get_ip_str());
+    }
+
+    return fd;
+}
+
+/* Function sends an rtnetlink request and calls handle on every message of the reply */
+static void netlink_query(struct nlmsghdr *request, const std::function<void(const struct nlmsghdr *)> &handle) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    request->nlmsg_flags |= NLM_F_REQUEST;
+    request->nlmsg_seq = 1;
+
+    if (send(fd, request, request->nlmsg_len, 0) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category());
+    }
+
+    std::vector<char> buf(NETLINK_BUF_SIZE);
+
+    while (true) {
+        ssize_t length = recv(fd, buf.data(), buf.size(), 0);
+        if (length == -1) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category());
+        }
+
+        int remaining = static_cast<int>(length);
+
+        // A dump ends with NLMSG_DONE, a single reply is not followed by anything
+        for (struct nlmsghdr *msg = reinterpret_cast<struct nlmsghdr *>(buf.data()); NLMSG_OK(msg, remaining);
+             msg = NLMSG_NEXT(msg, remaining)) {
+            if (msg->nlmsg_type == NLMSG_DONE) {
+                close(fd);
+                return;
+            }
+
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = static_cast<const struct nlmsgerr *>(NLMSG_DATA(msg));
+                close(fd);
+
+                if (err->error != 0) {
+                    throw std::system_error(-err->error, std::generic_category());
+                }
+
+                return;
+            }
+
+            handle(msg);
+
+            if (!(msg->nlmsg_flags & NLM_F_MULTI)) {
+                close(fd);
+                return;
+            }
+        }
+    }
+}
+
+/* Function finds the link-layer address of addr in the neighbour table, false if it is not resolved */
+static bool find_neighbour(int ifindex, const Address &addr, std::vector<u_int8_t> &link_addr) {
+    struct {
+        struct nlmsghdr header;
+        struct ndmsg msg;
+    } request = {};
+
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof (struct ndmsg));
+    request.header.nlmsg_type = RTM_GETNEIGH;
+    request.header.nlmsg_flags = NLM_F_DUMP;
+    request.msg.ndm_family = static_cast<u_int8_t>(addr.get_family());
+
+    size_t addr_len;
+    const void *addr_bytes = ip_bytes(addr, addr_len);
+    bool found = false;
+
+    netlink_query(&request.header, [&](const struct nlmsghdr *msg) {
+        const struct ndmsg *neighbour = static_cast<const struct ndmsg *>(NLMSG_DATA(msg));
+
+        if (found || msg->nlmsg_type != RTM_NEWNEIGH || neighbour->ndm_ifindex != ifindex ||
+            (neighbour->ndm_state & (NUD_INCOMPLETE | NUD_FAILED))) {
+            return;
+        }
+
+        const struct rtattr *dst = nullptr, *lladdr = nullptr;
+        int length = RTM_PAYLOAD(msg);
+
+        for (const struct rtattr *attr = reinterpret_cast<const struct rtattr *>(neighbour + 1);
+             RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+            if (attr->rta_type == NDA_DST) {
+                dst = attr;
+            } else if (attr->rta_type == NDA_LLADDR) {
+                lladdr = attr;
+            }
+        }
+
+        if (dst != nullptr && lladdr != nullptr && RTA_PAYLOAD(dst) == addr_len &&
+            memcmp(RTA_DATA(dst), addr_bytes, addr_len) == 0) {
+            const u_int8_t *bytes = static_cast<const u_int8_t *>(RTA_DATA(lladdr));
+            link_addr.assign(bytes, bytes + RTA_PAYLOAD(lladdr));
+            found = true;
+        }
+    });
+
+    return found;
+}
+
+Route find_next_hop(const Address &to) {
+    Route route;
+
+    struct {
+        struct nlmsghdr header;
+        struct rtmsg msg;
+        char attrs[RTA_SPACE(sizeof (in6_addr))];
+    } request = {};
+
+    size_t addr_len;
+    const void *addr_bytes = ip_bytes(to, addr_len);
+
+    request.header.nlmsg_len = NLMSG_LENGTH(sizeof (struct rtmsg));
+    request.header.nlmsg_type = RTM_GETROUTE;
+    request.msg.rtm_family = static_cast<u_int8_t>(to.get_family());
+    request.msg.rtm_dst_len = addr_len * 8;
+
+    struct rtattr *dst = reinterpret_cast<struct rtattr *>(reinterpret_cast<char *>(&request.header) +
+                                                           NLMSG_ALIGN(request.header.nlmsg_len));
+    dst->rta_type = RTA_DST;
+    dst->rta_len = RTA_LENGTH(addr_len);
+    memcpy(RTA_DATA(dst), addr_bytes, addr_len);
+    request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + RTA_SPACE(addr_len);
+
+    route.next_hop = to;
+
+    netlink_query(&request.header, [&](const struct nlmsghdr *msg) {
+        if (msg->nlmsg_type != RTM_NEWROUTE) {
+            return;
+        }
+
+        const struct rtmsg *reply = static_cast<const struct rtmsg *>(NLMSG_DATA(msg));
+        int length = RTM_PAYLOAD(msg);
+
+        for (const struct rtattr *attr = RTM_RTA(reply); RTA_OK(attr, length); attr = RTA_NEXT(attr, length)) {
+            if (attr->rta_type == RTA_OIF) {
+                memcpy(&route.ifindex, RTA_DATA(attr), sizeof (int));
+            } else if (attr->rta_type == RTA_GATEWAY && RTA_PAYLOAD(attr) == addr_len) {
+                route.next_hop = make_address(to.get_family(), RTA_DATA(attr));
+            }
+        }
+    });
+
+    if (route.ifindex == 0) {
+        throw std::runtime_error("No route to " + to.get_ip_str());
+    }
+
+    return route;
+}
+
+Route find_route(const Address &to) {
+    Route route = find_next_hop(to);
+
+    // Source address is the one a connected socket gets
+    int fd = connect_udp(to, RESOLVE_PORT);
+
+    sockaddr_storage source;
+    socklen_t source_len = sizeof (source);
+
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&source), &source_len) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category());
+    }
+
+    close(fd);
+    route.source = Address(reinterpret_cast<const sockaddr *>(&source), source_len);
+
+    // Interfaces without ARP (tunnels) have no link-layer header, loopback takes any address
+    struct ifreq ifr = {};
+
+    if (if_indextoname(route.ifindex, ifr.ifr_name) == nullptr) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    int status = ioctl(fd, SIOCGIFFLAGS, &ifr);
+    int error = errno;
+    close(fd);
+
+    if (status == -1) {
+        throw std::system_error(error, std::generic_category(), ifr.ifr_name);
+    }
+
+    if (ifr.ifr_flags & IFF_LOOPBACK) {
+        route.link_addr.assign(LOOPBACK_ADDR_LEN, 0);
+        return route;
+    }
+
+    if (ifr.ifr_flags & IFF_NOARP) {
+        return route;
+    }
+
+    if (find_neighbour(route.ifindex, route.next_hop, route.link_addr)) {
+        return route;
+    }
+
+    // Any packet to the next hop makes the kernel resolve it
+    fd = connect_udp(route.next_hop, RESOLVE_PORT);
+    (void) send(fd, nullptr, 0, 0);
+    close(fd);
+
+    route.resolved = false;
+    return route;
+}
+
+bool resolve_link_addr(Route &route) {
+    if (!route.resolved) {
+        route.resolved = find_neighbour(route.ifindex, route.next_hop, route.link_addr);
+    }
+
+    return route.resolved;
+}
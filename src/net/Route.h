@@ -0,0 +1,44 @@
+#ifndef NET_ROUTE_H
+#define NET_ROUTE_H
+
+#include "Address.h"
+
+#include <cstdint>
+#include <vector>
+
+/* Way out of the host to a destination, as the kernel routes it */
+struct Route {
+    int ifindex = 0;
+
+    // Source address of packets to the destination
+    Address source;
+
+    // Gateway, or the destination itself if it is on the link
+    Address next_hop;
+
+    // Link-layer address of next_hop, empty if the interface has no link-layer header
+    std::vector<u_int8_t> link_addr;
+
+    // False while the next hop is missing from the neighbour table, link_addr is empty then
+    bool resolved = true;
+};
+
+/*
+ * Function asks the kernel (rtnetlink) for the route to an address and the link-layer
+ * address of its next hop. A next hop missing from the neighbour table is sent an empty
+ * UDP datagram, which makes the kernel resolve it, and the route is returned unresolved
+ * without waiting; see resolve_link_addr. std::runtime_error is thrown if there is no route.
+ */
+Route find_route(const Address &to);
+
+/*
+ * Function asks the kernel for the interface and next hop of the route to an address
+ * only, source and link_addr are left empty. It is cheaper than find_route, for
+ * checking many destinations.
+ */
+Route find_next_hop(const Address &to);
+
+/* Function looks the next hop of an unresolved route up in the neighbour table again, true once it is resolved */
+bool resolve_link_addr(Route &route);
+
+#endif // NET_ROUTE_H
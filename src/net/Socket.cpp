@@ -10,8 +10,33 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <stdexcept>
-#include <sys/select.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <linux/filter.h>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+// From linux/icmp.h, which clashes with netinet/ip_icmp.h
+#ifndef ICMP_FILTER
+#define ICMP_FILTER 1
+#endif
+
+int Socket::hop_limit_(const struct msghdr &msg) {
+    for (const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&msg), const_cast<struct cmsghdr *>(cmsg))) {
+        if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL) ||
+            (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT)) {
+            int hop_limit;
+            memcpy(&hop_limit, CMSG_DATA(cmsg), sizeof (hop_limit));
+            return hop_limit;
+        }
+    }
+
+    return -1;
+}
 
 Socket::Socket(AddressFamily addr_family, SocketType type, Protocol protocol) : family_(addr_family) {
     // socket() arguments are of type int
@@ -30,6 +55,10 @@ Socket::Socket::~Socket() {
     close(socket_FD_);
 }
 
+int Socket::get_fd() const {
+    return socket_FD_;
+}
+
 int Socket::send(char *send_buf, size_t buf_length, const Address &to) {
     int status;
 
@@ -42,6 +71,69 @@ int Socket::send(char *send_buf, size_t buf_length, const Address &to) {
     return status;
 }
 
+void Socket::prepare_send_(const OutPacket *packets, size_t count) {
+    int level, type;
+
+    switch (family_) {
+        case AddressFamily::Inet:
+            level = IPPROTO_IP;
+            type = IP_TTL;
+            break;
+        case AddressFamily::Inet6:
+            level = IPPROTO_IPV6;
+            type = IPV6_HOPLIMIT;
+            break;
+        default:
+            throw std::runtime_error("Unhandled family in send_batch method");
+    }
+
+    const size_t cmsg_space = CMSG_SPACE(sizeof(int));
+
+    if (send_msgs_.size() < count) {
+        send_msgs_.resize(count);
+        send_iovs_.resize(count);
+        send_cmsgs_.resize(count * cmsg_space);
+    }
+
+    memset(send_cmsgs_.data(), 0, count * cmsg_space);
+
+    for (size_t i = 0; i < count; ++i) {
+        send_iovs_[i].iov_base = const_cast<char *>(packets[i].buf);
+        send_iovs_[i].iov_len = packets[i].length;
+
+        struct msghdr &msg = send_msgs_[i].msg_hdr;
+        msg = msghdr();
+        msg.msg_name = packets[i].to->get_sockaddr_ptr();
+        msg.msg_namelen = packets[i].to->get_length();
+        msg.msg_iov = &send_iovs_[i];
+        msg.msg_iovlen = 1;
+        msg.msg_control = send_cmsgs_.data() + i * cmsg_space;
+        msg.msg_controllen = cmsg_space;
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = level;
+        cmsg->cmsg_type = type;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &packets[i].ttl, sizeof(int));
+    }
+}
+
+void Socket::send_batch(const OutPacket *packets, size_t count) {
+    prepare_send_(packets, count);
+
+    // sendmmsg may send only a part of the batch, continue with the rest
+    size_t sent = 0;
+    while (sent < count) {
+        int status = sendmmsg(socket_FD_, send_msgs_.data() + sent, count - sent, 0);
+
+        if (status == -1) {
+            throw std::system_error(errno, std::generic_category());
+        }
+
+        sent += status;
+    }
+}
+
 int Socket::recv(char *recv_buf, size_t buf_length, Address &from) {
     int status;
     socklen_t address_length = from.get_length();
@@ -58,22 +150,43 @@ int Socket::recv(char *recv_buf, size_t buf_length, Address &from) {
     return status;
 }
 
-bool Socket::wait_for_recv(int seconds, int microseconds) {
-    timeval tv = {};
-    tv.tv_sec = seconds;
-    tv.tv_usec = microseconds;
+size_t Socket::recv_batch(RecvBatch &batch) {
+    for (size_t i = 0; i < batch.capacity(); ++i) {
+        struct msghdr &msg = batch.msgs_[i].msg_hdr;
+        msg = msghdr();
 
-    fd_set set;
-    FD_ZERO(&set);
-    FD_SET(socket_FD_, &set);
+        // Source addresses are written directly into the Address slots
+        batch.from_[i].set_length(sizeof(struct sockaddr_storage));
+        msg.msg_name = batch.from_[i].get_sockaddr_ptr();
+        msg.msg_namelen = batch.from_[i].get_length();
+        msg.msg_iov = &batch.iovs_[i];
+        msg.msg_iovlen = 1;
+        msg.msg_control = batch.cmsgs_.data() + i * CMSG_SPACE(sizeof (int));
+        msg.msg_controllen = CMSG_SPACE(sizeof (int));
+    }
+
+    auto recv_time = std::chrono::steady_clock::now();
+    int status = recvmmsg(socket_FD_, batch.msgs_.data(), batch.capacity(), MSG_DONTWAIT, nullptr);
 
-    if (select(socket_FD_ + 1, &set, nullptr, nullptr, &tv) == -1) {
-        throw std::system_error(std::error_code(errno, std::generic_category()));
+    if (status == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            status = 0;
+        } else {
+            throw std::system_error(errno, std::generic_category());
+        }
     }
 
-    return static_cast<bool>(FD_ISSET(socket_FD_, &set));
-}
+    for (int i = 0; i < status; ++i) {
+        batch.packets_[i] = static_cast<const char *>(batch.iovs_[i].iov_base);
+        batch.lengths_[i] = batch.msgs_[i].msg_len;
+        batch.from_[i].set_length(batch.msgs_[i].msg_hdr.msg_namelen);
+        batch.hop_limits_[i] = hop_limit_(batch.msgs_[i].msg_hdr);
+        batch.recv_times_[i] = recv_time;
+    }
 
+    batch.size_ = status;
+    return batch.size_;
+}
 
 void Socket::set_ttl(int ttl) {
     int status = 0;
@@ -93,3 +206,70 @@ void Socket::set_ttl(int ttl) {
         throw std::system_error(errno, std::generic_category());
     }
 }
+
+void Socket::set_recv_hop_limit() {
+    int on = 1;
+    int status = 0;
+
+    switch (family_) {
+        case AddressFamily::Inet:
+            status = setsockopt(socket_FD_, IPPROTO_IP, IP_RECVTTL, &on, sizeof (int));
+            break;
+        case AddressFamily::Inet6:
+            status = setsockopt(socket_FD_, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof (int));
+            break;
+        default:
+            throw std::runtime_error("Unhandled family in set_recv_hop_limit method");
+    }
+
+    if (status == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void Socket::set_recv_buffer_size(int bytes) {
+    // Privileged processes may exceed net.core.rmem_max
+    if (setsockopt(socket_FD_, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof (int)) == 0) {
+        return;
+    }
+
+    if (setsockopt(socket_FD_, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof (int)) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void Socket::set_icmp_type_filter(const std::vector<u_int8_t> &pass_types) {
+    int ret;
+
+    if (family_ == AddressFamily::Inet) {
+        // Bit set means the type is blocked, only types below 32 can be passed
+        u_int32_t blocked = ~0u;
+        for (u_int8_t type : pass_types) {
+            if (type < 32) {
+                blocked &= ~(1u << type);
+            }
+        }
+        ret = setsockopt(socket_FD_, SOL_RAW, ICMP_FILTER, &blocked, sizeof (blocked));
+    } else {
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        for (u_int8_t type : pass_types) {
+            ICMP6_FILTER_SETPASS(type, &filter);
+        }
+        ret = setsockopt(socket_FD_, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof (filter));
+    }
+
+    if (ret == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
+
+void Socket::attach_filter(const std::vector<struct sock_filter> &program) {
+    struct sock_fprog fprog;
+    fprog.len = program.size();
+    fprog.filter = const_cast<struct sock_filter *>(program.data());
+
+    if (setsockopt(socket_FD_, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof (fprog)) == -1) {
+        throw std::system_error(errno, std::generic_category());
+    }
+}
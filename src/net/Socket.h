@@ -7,23 +7,65 @@
 
 #include "enums.h"
 #include "Address.h"
+#include "PacketIo.h"
 
-class Socket {
+#include <linux/filter.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <vector>
+
+class Socket : public PacketIo {
 public:
     Socket(AddressFamily addr_family, SocketType type, Protocol protocol);
 
+    int get_fd() const override;
+
     int send(char *send_buf, size_t buf_length, const Address &to);
     int recv(char *recv_buf, size_t buf_length, Address &from);
 
     /*
-     * Method returns true if socket is ready for reading or false if given
-     * amount of seconds passed and there's nothing to read.
+     * Method sends all count packets using as few sendmmsg calls as possible. The TTL of
+     * every packet is passed as ancillary data (IP_TTL / IPV6_HOPLIMIT), so a single
+     * batch may mix destinations and TTLs.
      */
-    bool wait_for_recv(int seconds, int microseconds);
+    void send_batch(const OutPacket *packets, size_t count) override;
+
+    /*
+     * Method receives as many packets as are queued on the socket (at most
+     * batch.capacity()) with a single recvmmsg call. It does not block, returns
+     * the number of packets received (0 if there was nothing to read).
+     */
+    size_t recv_batch(RecvBatch &batch) override;
 
     void set_ttl(int ttl);
 
-    virtual ~Socket();
+    /* Makes received packets carry their TTL (hop limit), otherwise RecvBatch::get_hop_limit is -1 */
+    void set_recv_hop_limit();
+
+    /* Sets SO_RCVBUF, without CAP_NET_ADMIN the kernel caps it at net.core.rmem_max */
+    void set_recv_buffer_size(int bytes);
+
+    /*
+     * Raw ICMP sockets only. Method makes the kernel drop ICMP messages whose type is
+     * not in pass_types (ICMP_FILTER / ICMP6_FILTER).
+     */
+    void set_icmp_type_filter(const std::vector<u_int8_t> &pass_types);
+
+    void attach_filter(const std::vector<struct sock_filter> &program) override;
+
+    ~Socket() override;
+protected:
+    /* Method fills send_msgs_ with the messages of count packets, see send_batch */
+    void prepare_send_(const OutPacket *packets, size_t count);
+
+    /* TTL (hop limit) carried by the ancillary data of a received packet, -1 if there is none */
+    static int hop_limit_(const struct msghdr &msg);
+
+    // Buffers for send_batch, kept between calls to avoid allocations
+    std::vector<struct mmsghdr> send_msgs_;
+    std::vector<struct iovec> send_iovs_;
+    std::vector<char> send_cmsgs_;
 private:
     int socket_FD_ = -1;
     AddressFamily family_;
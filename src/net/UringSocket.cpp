@@ -0,0 +1,312 @@
+#include "UringSocket.h"
+#include "Socket.h"
+#include "IoUring.h"
+#include "PacketIo.h"
+#include "enums.h"
+
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+// Sending ring takes a whole batch of the prober at once
+constexpr unsigned SEND_RING_ENTRIES = 256;
+
+// 512 KiB of receive buffers, a buffer holds the header of the completion, the address,
+// the ancillary data and a packet
+constexpr unsigned RECV_BUF_COUNT = 256;
+constexpr size_t RECV_BUF_SIZE = 2048;
+constexpr u_int16_t RECV_BUF_GROUP = 0;
+
+// Every provided buffer may end up in a completion, and some more for the ends of multishots
+constexpr unsigned RECV_RING_ENTRIES = 4;
+constexpr unsigned RECV_CQ_ENTRIES = 2 * RECV_BUF_COUNT;
+
+// user_data of the entries
+constexpr u_int64_t SEND_DATA = 1;
+constexpr u_int64_t RECV_DATA = 2;
+constexpr u_int64_t CANCEL_DATA = 3;
+
+constexpr size_t BUF_RING_SIZE = RECV_BUF_COUNT * sizeof (struct io_uring_buf);
+
+UringSocket::UringSocket(AddressFamily addr_family, SocketType type, Protocol protocol) :
+    Socket(addr_family, type, protocol), send_ring_(SEND_RING_ENTRIES, 2 * SEND_RING_ENTRIES),
+    recv_ring_(RECV_RING_ENTRIES, RECV_CQ_ENTRIES)
+{
+    // Ring of buffer addresses must be page aligned, the buffers follow it
+    void *map = mmap(nullptr, BUF_RING_SIZE + RECV_BUF_COUNT * RECV_BUF_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(), "mmap of the receive buffers");
+    }
+
+    buf_ring_ = static_cast<struct io_uring_buf_ring *>(map);
+    bufs_ = static_cast<char *>(map) + BUF_RING_SIZE;
+
+    try {
+        recv_ring_.register_buf_ring(buf_ring_, RECV_BUF_COUNT, RECV_BUF_GROUP);
+
+        for (unsigned id = 0; id < RECV_BUF_COUNT; ++id) {
+            provide_buf_(id);
+        }
+
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+
+        recv_msg_ = msghdr();
+        recv_msg_.msg_namelen = sizeof (struct sockaddr_storage);
+        recv_msg_.msg_controllen = CMSG_SPACE(sizeof (int));
+
+        check_multishot_();
+    } catch (...) {
+        release_();
+        throw;
+    }
+
+    bufs_out_.reserve(RECV_BUF_COUNT);
+}
+
+UringSocket::~UringSocket() {
+    // Kernel must not read into the buffers once they are unmapped
+    try {
+        disarm_();
+    } catch (const std::system_error &) {
+    }
+
+    release_();
+}
+
+void UringSocket::release_() {
+    if (buf_ring_ != nullptr) {
+        munmap(buf_ring_, BUF_RING_SIZE + RECV_BUF_COUNT * RECV_BUF_SIZE);
+    }
+
+    buf_ring_ = nullptr;
+    bufs_ = nullptr;
+}
+
+int UringSocket::get_fd() const {
+    return recv_ring_.get_fd();
+}
+
+void UringSocket::provide_buf_(u_int16_t id) {
+    // Not buf_ring_->bufs, the flexible array of the header is not at offset 0 in C++
+    struct io_uring_buf &buf = reinterpret_cast<struct io_uring_buf *>(buf_ring_)[buf_tail_ & (RECV_BUF_COUNT - 1)];
+    buf.addr = reinterpret_cast<u_int64_t>(bufs_ + id * RECV_BUF_SIZE);
+    buf.len = RECV_BUF_SIZE;
+    buf.bid = id;
+
+    // Kernel sees the buffer once the tail is stored
+    ++buf_tail_;
+}
+
+void UringSocket::arm_() {
+    struct io_uring_sqe *sqe = recv_ring_.get_sqe();
+    if (sqe == nullptr) {
+        throw std::system_error(EBUSY, std::generic_category(), "io_uring submission queue");
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = Socket::get_fd();
+    sqe->addr = reinterpret_cast<u_int64_t>(&recv_msg_);
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = RECV_DATA;
+
+    recv_ring_.submit();
+    armed_ = true;
+}
+
+/*
+ * Method arms a multishot recvmsg and cancels it right away. A kernel which does not
+ * know the flag rejects the entry as it is submitted.
+ */
+void UringSocket::check_multishot_() {
+    arm_();
+
+    const struct io_uring_cqe *cqe = recv_ring_.peek_cqe();
+    if (cqe != nullptr && cqe->user_data == RECV_DATA && cqe->res < 0 && cqe->res != -ENOBUFS) {
+        throw std::system_error(-cqe->res, std::generic_category(), "multishot recvmsg");
+    }
+
+    disarm_();
+}
+
+/* Method cancels the multishot recvmsg and waits until the kernel ends it */
+void UringSocket::disarm_() {
+    if (!armed_) {
+        return;
+    }
+
+    // It may have ended already, the kernel cancels requests of a thread which exits
+    struct io_uring_sqe *sqe = recv_ring_.get_sqe();
+    if (sqe == nullptr) {
+        throw std::system_error(EBUSY, std::generic_category(), "io_uring submission queue");
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = RECV_DATA;
+    sqe->user_data = CANCEL_DATA;
+    recv_ring_.submit();
+
+    bool cancelled = false;
+
+    while (armed_ || !cancelled) {
+        const struct io_uring_cqe *cqe = recv_ring_.peek_cqe();
+        if (cqe == nullptr) {
+            recv_ring_.submit(1);
+            continue;
+        }
+
+        if (cqe->user_data == CANCEL_DATA) {
+            cancelled = true;
+        } else if (cqe->user_data == RECV_DATA) {
+            // Packets read meanwhile are dropped
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                provide_buf_(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                armed_ = false;
+            }
+        }
+
+        recv_ring_.cqe_seen();
+    }
+
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+void UringSocket::send_batch(const OutPacket *packets, size_t count) {
+    prepare_send_(packets, count);
+
+    size_t sent = 0;
+
+    while (sent < count) {
+        unsigned submitted = 0;
+
+        // Sends are not linked, a packet which fails does not cancel the rest of the batch
+        for (; sent < count; ++sent, ++submitted) {
+            struct io_uring_sqe *sqe = send_ring_.get_sqe();
+            if (sqe == nullptr) {
+                break;
+            }
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = Socket::get_fd();
+            sqe->addr = reinterpret_cast<u_int64_t>(&send_msgs_[sent].msg_hdr);
+            sqe->len = 1;
+            sqe->user_data = SEND_DATA;
+        }
+
+        // Packets belong to the caller, so they are all sent before returning
+        send_ring_.submit(submitted);
+
+        int error = 0;
+
+        while (submitted > 0) {
+            // A signal may have cut the wait short
+            const struct io_uring_cqe *cqe = send_ring_.peek_cqe();
+            if (cqe == nullptr) {
+                send_ring_.submit(submitted);
+                continue;
+            }
+
+            if (cqe->res < 0 && error == 0) {
+                error = -cqe->res;
+            }
+
+            send_ring_.cqe_seen();
+            --submitted;
+        }
+
+        if (error != 0) {
+            throw std::system_error(error, std::generic_category());
+        }
+    }
+}
+
+size_t UringSocket::recv_batch(RecvBatch &batch) {
+    // Packets of the last batch are not needed anymore
+    for (u_int16_t id : bufs_out_) {
+        provide_buf_(id);
+    }
+
+    if (!bufs_out_.empty()) {
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+        bufs_out_.clear();
+    }
+
+    if (!armed_) {
+        arm_();
+    }
+
+    auto recv_time = std::chrono::steady_clock::now();
+    const struct io_uring_cqe *cqe;
+    size_t n = 0;
+
+    while (n < batch.capacity() && (cqe = recv_ring_.peek_cqe()) != nullptr) {
+        int res = cqe->res;
+        u_int32_t flags = cqe->flags;
+        bool packet = cqe->user_data == RECV_DATA;
+        recv_ring_.cqe_seen();
+
+        if (!packet) {
+            continue;
+        }
+
+        if (!(flags & IORING_CQE_F_MORE)) {
+            armed_ = false;
+        }
+
+        // Out of buffers, the packets wait in the socket until it is rearmed
+        if (res == -ENOBUFS) {
+            continue;
+        }
+
+        if (res < 0) {
+            throw std::system_error(-res, std::generic_category(), "multishot recvmsg");
+        }
+
+        if (!(flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+
+        u_int16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+        bufs_out_.push_back(id);
+
+        // Name and control take the room the message asked for, whatever their length
+        const char *buf = bufs_ + id * RECV_BUF_SIZE;
+        const struct io_uring_recvmsg_out *out = reinterpret_cast<const struct io_uring_recvmsg_out *>(buf);
+        const char *name = buf + sizeof (struct io_uring_recvmsg_out);
+        const char *control = name + recv_msg_.msg_namelen;
+        const char *payload = control + recv_msg_.msg_controllen;
+
+        size_t name_len = std::min<size_t>(out->namelen, recv_msg_.msg_namelen);
+        memcpy(batch.from_[n].get_sockaddr_ptr(), name, name_len);
+        batch.from_[n].set_length(name_len);
+
+        struct msghdr msg = msghdr();
+        msg.msg_control = const_cast<char *>(control);
+        msg.msg_controllen = out->controllen;
+
+        batch.packets_[n] = payload;
+        batch.lengths_[n] = std::min<size_t>(out->payloadlen, static_cast<size_t>(res) - (payload - buf));
+        batch.hop_limits_[n] = hop_limit_(msg);
+        batch.recv_times_[n] = recv_time;
+        ++n;
+    }
+
+    // Rearmed right away, the kernel would otherwise not read the socket until the next call
+    if (!armed_) {
+        arm_();
+    }
+
+    batch.size_ = n;
+    return n;
+}
@@ -0,0 +1,70 @@
+#ifndef NET_URING_SOCKET_H
+#define NET_URING_SOCKET_H
+
+#include "Socket.h"
+#include "IoUring.h"
+#include "PacketIo.h"
+#include "enums.h"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Class UringSocket is a raw Socket whose batches go through io_uring instead of
+ * sendmmsg and recvmmsg. Its two rings are used by different threads: the sending one
+ * by send_batch, the receiving one by recv_batch.
+ *
+ * send_batch submits a sendmsg entry per packet and waits for all of them with a single
+ * io_uring_enter, so the caller may reuse the packets right away as with sendmmsg.
+ *
+ * Receiving is a multishot recvmsg armed once: the kernel reads every packet into a
+ * buffer of a ring provided by the socket and posts a completion, with no system call
+ * of the process. recv_batch only picks up the completions and gives their buffers back
+ * on its next call. The multishot is armed by the first recv_batch, so that the kernel
+ * does the reading in the context of the receiving thread, and it is rearmed whenever
+ * the kernel ends it (all buffers in use). get_fd returns the receiving ring, which is
+ * readable while completions are waiting.
+ */
+class UringSocket : public Socket {
+public:
+    /*
+     * Throws std::system_error if the kernel cannot do io_uring with provided buffer rings
+     * and multishot recvmsg (Linux 6.0) or io_uring is disabled, plain Socket works then.
+     */
+    UringSocket(AddressFamily addr_family, SocketType type, Protocol protocol);
+    ~UringSocket() override;
+
+    int get_fd() const override;
+
+    void send_batch(const OutPacket *packets, size_t count) override;
+    size_t recv_batch(RecvBatch &batch) override;
+
+private:
+    IoUring send_ring_;
+    IoUring recv_ring_;
+
+    // Provided buffers and the ring of their addresses, both mapped anonymously
+    char *bufs_ = nullptr;
+    struct io_uring_buf_ring *buf_ring_ = nullptr;
+    u_int16_t buf_tail_ = 0;
+
+    // Buffers the last recv_batch handed out
+    std::vector<u_int16_t> bufs_out_;
+
+    // Message of the multishot recvmsg, tells the kernel how much room name and control take
+    struct msghdr recv_msg_;
+    bool armed_ = false;
+
+    void release_();
+
+    void provide_buf_(u_int16_t id);
+    void arm_();
+    void check_multishot_();
+    void disarm_();
+};
+
+#endif // NET_URING_SOCKET_H
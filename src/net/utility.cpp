@@ -10,7 +10,11 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
+#include <system_error>
+#include <cerrno>
 #include <cstring>
 #include <cstdint>
 
@@ -90,3 +94,17 @@ AddressFamily ip_version(const std::string ip_address) {
 
     return AddressFamily::Unspec;
 }
+
+void make_parent_dirs(const std::string &path) {
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+
+        if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), dir);
+        }
+    }
+}
+
+bool runs_setuid() {
+    return getuid() != geteuid() || getgid() != getegid();
+}
@@ -15,4 +15,13 @@ Address str_to_address(const std::string ip_or_hostname, AddressFamily af_if_unk
 uint16_t compute_checksum(uint16_t * addr, int len);
 AddressFamily ip_version(const std::string ip_address);
 
+/* Function creates every missing directory on the path to the file */
+void make_parent_dirs(const std::string &path);
+
+/*
+ * True if the process runs with the rights of another user or group (a set-user-ID or
+ * set-group-ID program). Paths chosen by its caller must not be written then.
+ */
+bool runs_setuid();
+
 #endif // NET_UTILITY_H